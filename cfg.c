@@ -0,0 +1,227 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "xed/xed-interface.h"
+
+enum cfg_flow cfg_flow(const struct x86_length *fast)
+{
+    int reg = (fast->modrm >> 3) & 7;
+
+    if (fast->encoding != X86_ENCODING_LEGACY) {
+        return CFG_FLOW_NEXT;
+    }
+    if (fast->map == 0) {
+        switch (fast->opcode) {
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+        case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
+        case 0xe0: case 0xe1: case 0xe2: case 0xe3:
+            return CFG_FLOW_BRANCH;
+        case 0xc7:  // XBEGIN
+            return fast->modrm == 0xf8 ? CFG_FLOW_BRANCH : CFG_FLOW_NEXT;
+        case 0xe8:
+            return CFG_FLOW_CALL;
+        case 0xe9: case 0xeb:
+            return CFG_FLOW_JUMP;
+        case 0xc2: case 0xc3: case 0xca: case 0xcb: case 0xcf:
+            return CFG_FLOW_RETURN;
+        case 0xcc: case 0xf4:
+            return CFG_FLOW_STOP;
+        case 0xff:
+            return reg == 4 || reg == 5 ? CFG_FLOW_INDIRECT : CFG_FLOW_NEXT;
+        default:
+            return CFG_FLOW_NEXT;
+        }
+    }
+    if (fast->map == 1) {
+        if (fast->opcode >= 0x80 && fast->opcode <= 0x8f) {
+            return CFG_FLOW_BRANCH;
+        }
+        // UD2, UD1 and UD0
+        if (fast->opcode == 0x0b || fast->opcode == 0xb9 || fast->opcode == 0xff) {
+            return CFG_FLOW_STOP;
+        }
+    }
+    return CFG_FLOW_NEXT;
+}
+
+size_t cfg_xed_length(const uint8_t *inst, size_t len)
+{
+    xed_decoded_inst_t xedd;
+    xed_decoded_inst_zero(&xedd);
+    xed_decoded_inst_set_mode(&xedd, XED_MACHINE_MODE_LONG_64, XED_ADDRESS_WIDTH_64b);
+    if (xed_decode(&xedd, inst, len) != XED_ERROR_NONE) {
+        return 0;
+    }
+    return xed_decoded_inst_get_length(&xedd);
+}
+
+static void decode(struct cfg *cfg)
+{
+    size_t capacity = 0;
+
+    for (size_t offset = 0; offset < cfg->size;) {
+        struct x86_length fast;
+        struct cfg_inst inst = { cfg->address + offset, 0, CFG_FLOW_NEXT, 0 };
+        size_t length = x86_length_decode(cfg->code + offset, cfg->size - offset, &fast);
+
+        if (length != 0) {
+            inst.flow = cfg_flow(&fast);
+            if (inst.flow == CFG_FLOW_CALL || inst.flow == CFG_FLOW_JUMP || inst.flow == CFG_FLOW_BRANCH) {
+                const uint8_t *imm = cfg->code + offset + length - fast.imm_size;
+                int32_t disp = (int8_t) imm[0];
+                if (fast.imm_size == 4) {
+                    memcpy(&disp, imm, sizeof(disp));
+                }
+                inst.target = inst.address + length + disp;
+            }
+        } else {
+            length = cfg_xed_length(cfg->code + offset, cfg->size - offset);
+            if (length == 0) {
+                length = 1;
+                inst.flow = CFG_FLOW_STOP;
+            }
+        }
+        inst.length = length;
+
+        if (cfg->ninsts == capacity) {
+            capacity = capacity == 0 ? 64 : capacity * 2;
+            cfg->insts = realloc(cfg->insts, capacity * sizeof(*cfg->insts));
+        }
+        cfg->insts[cfg->ninsts++] = inst;
+        offset += length;
+    }
+}
+
+// return the index of the instruction at address or SIZE_MAX
+static size_t inst_at(const struct cfg *cfg, uint64_t address)
+{
+    size_t lo = 0;
+    size_t hi = cfg->ninsts;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->insts[mid].address < address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < cfg->ninsts && cfg->insts[lo].address == address ? lo : SIZE_MAX;
+}
+
+static bool has_target(enum cfg_flow flow)
+{
+    return flow == CFG_FLOW_JUMP || flow == CFG_FLOW_BRANCH;
+}
+
+static bool ends_block(enum cfg_flow flow)
+{
+    return flow != CFG_FLOW_NEXT && flow != CFG_FLOW_CALL;
+}
+
+void cfg_build(struct cfg *cfg, const uint8_t *code, size_t size, uint64_t address)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->code = code;
+    cfg->address = address;
+    cfg->size = size;
+
+    decode(cfg);
+    if (cfg->ninsts == 0) {
+        return;
+    }
+
+    bool *leader = calloc(cfg->ninsts, sizeof(*leader));
+    leader[0] = true;
+    for (size_t i = 0; i < cfg->ninsts; ++i) {
+        const struct cfg_inst *inst = &cfg->insts[i];
+        if (has_target(inst->flow)) {
+            size_t target = inst_at(cfg, inst->target);
+            if (target != SIZE_MAX) {
+                leader[target] = true;
+            }
+        }
+        if (ends_block(inst->flow) && i + 1 < cfg->ninsts) {
+            leader[i + 1] = true;
+        }
+    }
+
+    size_t nblocks = 0;
+    for (size_t i = 0; i < cfg->ninsts; ++i) {
+        nblocks += leader[i];
+    }
+    cfg->blocks = malloc(nblocks * sizeof(*cfg->blocks));
+    for (size_t i = 0; i < cfg->ninsts; ++i) {
+        if (leader[i]) {
+            cfg->blocks[cfg->nblocks++] = (struct cfg_block) {
+                i, 0, cfg->insts[i].address, 0, CFG_NO_BLOCK, CFG_NO_BLOCK,
+            };
+        }
+        struct cfg_block *block = &cfg->blocks[cfg->nblocks - 1];
+        block->count += 1;
+        block->end = cfg->insts[i].address + cfg->insts[i].length;
+    }
+    free(leader);
+
+    for (size_t b = 0; b < cfg->nblocks; ++b) {
+        struct cfg_block *block = &cfg->blocks[b];
+        const struct cfg_inst *last = &cfg->insts[block->first + block->count - 1];
+        if (has_target(last->flow)) {
+            block->taken = cfg_block_at(cfg, last->target);
+        }
+        if ((last->flow == CFG_FLOW_NEXT || last->flow == CFG_FLOW_CALL || last->flow == CFG_FLOW_BRANCH) &&
+            b + 1 < cfg->nblocks) {
+            block->next = b + 1;
+        }
+    }
+}
+
+void cfg_free(struct cfg *cfg)
+{
+    free(cfg->insts);
+    free(cfg->blocks);
+}
+
+size_t cfg_block_at(const struct cfg *cfg, uint64_t address)
+{
+    size_t lo = 0;
+    size_t hi = cfg->nblocks;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->blocks[mid].start < address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < cfg->nblocks && cfg->blocks[lo].start == address ? lo : CFG_NO_BLOCK;
+}
+
+void cfg_loop_ends(const struct cfg *cfg, uint64_t *loop_end)
+{
+    memset(loop_end, 0, cfg->nblocks * sizeof(*loop_end));
+    for (size_t b = 0; b < cfg->nblocks; ++b) {
+        size_t head = cfg->blocks[b].taken;
+        if (head != CFG_NO_BLOCK && head <= b && cfg->blocks[b].end > loop_end[head]) {
+            loop_end[head] = cfg->blocks[b].end;
+        }
+    }
+}
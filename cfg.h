@@ -0,0 +1,102 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __CFG_H__
+#define __CFG_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "x86len.h"
+
+// how control leaves an instruction
+enum cfg_flow {
+    // continues with the next instruction
+    CFG_FLOW_NEXT,
+    // direct call which returns to the next instruction
+    CFG_FLOW_CALL,
+    // direct JMP
+    CFG_FLOW_JUMP,
+    // Jcc, LOOP, JRCXZ and XBEGIN, which either jump or continue
+    CFG_FLOW_BRANCH,
+    // JMP through a register or memory
+    CFG_FLOW_INDIRECT,
+    CFG_FLOW_RETURN,
+    // INT3, HLT, UD2 and undecodable bytes
+    CFG_FLOW_STOP,
+};
+
+#define CFG_NO_BLOCK SIZE_MAX
+
+struct cfg_inst {
+    uint64_t address;
+    uint8_t length;
+    enum cfg_flow flow;
+    // valid for direct calls, jumps and branches
+    uint64_t target;
+};
+
+struct cfg_block {
+    // index of the first instruction and number of instructions
+    size_t first;
+    size_t count;
+    uint64_t start;
+    uint64_t end;
+    // fall-through and jump successors, or CFG_NO_BLOCK when control leaves
+    // the function or does not continue
+    size_t next;
+    size_t taken;
+};
+
+// Control-flow graph of one function, recovered from a linear sweep.  Only
+// direct branch targets which land on an instruction boundary inside the
+// function start blocks; other targets leave the function.
+struct cfg {
+    const uint8_t *code;
+    uint64_t address;
+    size_t size;
+    struct cfg_inst *insts;
+    size_t ninsts;
+    // sorted by address
+    struct cfg_block *blocks;
+    size_t nblocks;
+};
+
+// classify how control leaves an instruction decoded by x86_length_decode
+enum cfg_flow cfg_flow(const struct x86_length *fast);
+
+// return the length of an instruction x86_length_decode does not handle, or zero
+size_t cfg_xed_length(const uint8_t *inst, size_t len);
+
+void cfg_build(struct cfg *cfg, const uint8_t *code, size_t size, uint64_t address);
+
+void cfg_free(struct cfg *cfg);
+
+// return the index of the block starting at address or CFG_NO_BLOCK
+size_t cfg_block_at(const struct cfg *cfg, uint64_t address);
+
+// Set loop_end[b] to the end of the loop headed by block b or to zero.  The
+// back-edge furthest from the head bounds the body.
+void cfg_loop_ends(const struct cfg *cfg, uint64_t *loop_end);
+
+// return the bytes of an instruction
+static inline const uint8_t *cfg_inst_bytes(const struct cfg *cfg, const struct cfg_inst *inst)
+{
+    return cfg->code + (inst->address - cfg->address);
+}
+
+#endif
@@ -0,0 +1,438 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+#include "elffile.h"
+#include "parallel.h"
+#include "x86len.h"
+#include "x86lint.h"
+
+uint64_t hash_bytes(const uint8_t *data, size_t len)
+{
+    const uint64_t k = 0x9e3779b97f4a7c15;
+    uint64_t hash = len * k;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * k;
+        hash ^= hash >> 29;
+    }
+    for (; i < len; ++i) {
+        hash = (hash ^ data[i]) * k;
+    }
+    return hash ^ (hash >> 32);
+}
+
+uint64_t hash_code(const uint8_t *data, size_t len, uint64_t address, bool targets)
+{
+    uint8_t *copy = malloc(len);
+    memcpy(copy, data, len);
+
+    for (size_t offset = 0; offset < len;) {
+        struct x86_length fast;
+        size_t length = x86_length_decode(data + offset, len - offset, &fast);
+        // hash the remainder unmasked rather than guess at boundaries
+        if (length == 0) {
+            break;
+        }
+
+        uint8_t *field = NULL;
+        size_t size = 0;
+        if (fast.rip_relative) {
+            field = copy + offset + length - fast.imm_size - fast.disp_size;
+            size = fast.disp_size;
+        } else if (fast.relative_branch) {
+            field = copy + offset + length - fast.imm_size;
+            size = fast.imm_size;
+        }
+        if (field != NULL) {
+            int32_t disp;
+            if (size == 1) {
+                disp = (int8_t) field[0];
+            } else if (size == 2) {
+                int16_t disp16;
+                memcpy(&disp16, field, sizeof(disp16));
+                disp = disp16;
+            } else {
+                memcpy(&disp, field, sizeof(disp));
+            }
+            uint64_t target = address + offset + length + disp;
+            // displacements within the function do not change when it moves
+            if (target < address || target >= address + len) {
+                uint32_t value = targets ? (uint32_t) target : 0;
+                memcpy(field, &value, size);
+            }
+        }
+        offset += length;
+    }
+
+    uint64_t hash = hash_bytes(copy, len);
+    free(copy);
+    return hash;
+}
+
+struct function {
+    const struct elf_symbol *sym;
+    uint64_t hash;
+    // matching function in the other binary or NULL
+    struct function *match;
+    bool identical;
+    int errors;
+    int counts[X86LINT_RULE_COUNT];
+};
+
+struct binary {
+    struct elf_file elf;
+    struct elf_symbol *syms;
+    struct function *funcs;
+    size_t nfuncs;
+};
+
+static int open_binary(struct binary *bin, const char *path)
+{
+    memset(bin, 0, sizeof(*bin));
+    if (elf_open(&bin->elf, path) == -1) {
+        return -1;
+    }
+    ssize_t nsyms = elf_functions(&bin->elf, &bin->syms);
+    if (nsyms < 0) {
+        fprintf(stderr, "%s: no function symbols\n", path);
+        elf_close(&bin->elf);
+        return -1;
+    }
+    bin->nfuncs = nsyms;
+    bin->funcs = calloc(nsyms, sizeof(*bin->funcs));
+    for (ssize_t i = 0; i < nsyms; ++i) {
+        bin->funcs[i].sym = &bin->syms[i];
+    }
+    return 0;
+}
+
+static void close_binary(struct binary *bin)
+{
+    free(bin->funcs);
+    free(bin->syms);
+    elf_close(&bin->elf);
+}
+
+static void hash_function(void *arg, size_t i)
+{
+    struct function *func = &((struct function *) arg)[i];
+    func->hash = hash_code(func->sym->data, func->sym->size, func->sym->address, false);
+}
+
+static int compare_name_hash(const void *a, const void *b)
+{
+    const struct function *x = *(struct function *const *) a;
+    const struct function *y = *(struct function *const *) b;
+    int cmp = strcmp(x->sym->name, y->sym->name);
+
+    if (cmp != 0) {
+        return cmp;
+    }
+    return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+static int compare_hash(const void *a, const void *b)
+{
+    const struct function *x = *(struct function *const *) a;
+    const struct function *y = *(struct function *const *) b;
+    return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+static struct function **sorted_functions(struct binary *bin)
+{
+    struct function **sorted = malloc(bin->nfuncs * sizeof(*sorted));
+    for (size_t i = 0; i < bin->nfuncs; ++i) {
+        sorted[i] = &bin->funcs[i];
+    }
+    qsort(sorted, bin->nfuncs, sizeof(*sorted), compare_name_hash);
+    return sorted;
+}
+
+static void pair(struct function *x, struct function *y)
+{
+    x->match = y;
+    y->match = x;
+    x->identical = y->identical = x->hash == y->hash && x->sym->size == y->sym->size;
+}
+
+// Match functions by name, preferring equal contents among functions sharing
+// a name, then match the remainder by contents to follow renames.
+static void match_functions(struct binary *old, struct binary *new)
+{
+    struct function **a = sorted_functions(old);
+    struct function **b = sorted_functions(new);
+    size_t i = 0;
+    size_t j = 0;
+
+    while (i < old->nfuncs && j < new->nfuncs) {
+        int cmp = strcmp(a[i]->sym->name, b[j]->sym->name);
+        if (cmp < 0) {
+            ++i;
+            continue;
+        } else if (cmp > 0) {
+            ++j;
+            continue;
+        }
+        size_t i_end = i;
+        size_t j_end = j;
+        while (i_end < old->nfuncs && strcmp(a[i_end]->sym->name, a[i]->sym->name) == 0) {
+            ++i_end;
+        }
+        while (j_end < new->nfuncs && strcmp(b[j_end]->sym->name, b[j]->sym->name) == 0) {
+            ++j_end;
+        }
+        // both groups are sorted by hash
+        for (size_t x = i, y = j; x < i_end && y < j_end;) {
+            if (a[x]->hash < b[y]->hash) {
+                ++x;
+            } else if (a[x]->hash > b[y]->hash) {
+                ++y;
+            } else {
+                pair(a[x++], b[y++]);
+            }
+        }
+        for (size_t x = i, y = j; x < i_end && y < j_end;) {
+            if (a[x]->match != NULL) {
+                ++x;
+            } else if (b[y]->match != NULL) {
+                ++y;
+            } else {
+                pair(a[x++], b[y++]);
+            }
+        }
+        i = i_end;
+        j = j_end;
+    }
+
+    size_t na = 0;
+    size_t nb = 0;
+    for (i = 0; i < old->nfuncs; ++i) {
+        if (a[i]->match == NULL) {
+            a[na++] = a[i];
+        }
+    }
+    for (j = 0; j < new->nfuncs; ++j) {
+        if (b[j]->match == NULL) {
+            b[nb++] = b[j];
+        }
+    }
+    qsort(b, nb, sizeof(*b), compare_hash);
+    for (i = 0; i < na; ++i) {
+        struct function **found = bsearch(&a[i], b, nb, sizeof(*b), compare_hash);
+        if (found == NULL) {
+            continue;
+        }
+        // use the first unmatched function with this hash
+        while (found > b && (*(found - 1))->hash == a[i]->hash) {
+            --found;
+        }
+        while (found < b + nb && (*found)->hash == a[i]->hash && (*found)->match != NULL) {
+            ++found;
+        }
+        if (found < b + nb && (*found)->hash == a[i]->hash) {
+            pair(a[i], *found);
+        }
+    }
+
+    free(a);
+    free(b);
+}
+
+static void count_finding(void *arg, enum x86lint_rule rule, uint64_t address)
+{
+    struct function *func = arg;
+    ++func->counts[rule];
+}
+
+static void lint_function(void *arg, size_t i)
+{
+    struct function *func = ((struct function **) arg)[i];
+    struct x86lint_options options = {
+        .address = func->sym->address,
+        .quiet = true,
+        .on_finding = count_finding,
+        .arg = func,
+    };
+
+    func->errors = check_instructions_with(func->sym->data, func->sym->size, &options);
+    if (func->errors < 0) {
+        // count what was found before the decoding error
+        func->errors = 0;
+        for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+            func->errors += func->counts[rule];
+        }
+    }
+}
+
+struct function_delta {
+    const char *name;
+    const struct function *old;
+    const struct function *new;
+    int errors;
+    int64_t size;
+};
+
+static int compare_deltas(const void *a, const void *b)
+{
+    const struct function_delta *x = a;
+    const struct function_delta *y = b;
+
+    if (abs(x->errors) != abs(y->errors)) {
+        return abs(y->errors) - abs(x->errors);
+    }
+    if (x->size != y->size) {
+        return (x->size < 0 ? -x->size : x->size) < (y->size < 0 ? -y->size : y->size) ? 1 : -1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+static int function_errors(const struct function *func)
+{
+    return func != NULL ? func->errors : 0;
+}
+
+static uint64_t function_size(const struct function *func)
+{
+    return func != NULL ? func->sym->size : 0;
+}
+
+static void print_function_delta(const struct function_delta *delta)
+{
+    const char *status = delta->old == NULL ? "added" : delta->new == NULL ? "removed" : "changed";
+    const char *sep = " (";
+
+    printf("  %+d findings, %+" PRId64 " bytes: %s [%s]", delta->errors, delta->size, delta->name, status);
+    for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+        int d = (delta->new != NULL ? delta->new->counts[rule] : 0) -
+                (delta->old != NULL ? delta->old->counts[rule] : 0);
+        if (d != 0) {
+            printf("%s%s %+d", sep, x86lint_rule_name(rule), d);
+            sep = ", ";
+        }
+    }
+    printf("%s\n", sep[0] == ',' ? ")" : "");
+}
+
+int diff_files(const char *old_path, const char *new_path, long jobs)
+{
+    struct binary old, new;
+
+    if (open_binary(&old, old_path) == -1) {
+        return -1;
+    }
+    if (open_binary(&new, new_path) == -1) {
+        close_binary(&old);
+        return -1;
+    }
+
+    parallel_for(old.nfuncs, jobs, hash_function, old.funcs);
+    parallel_for(new.nfuncs, jobs, hash_function, new.funcs);
+    match_functions(&old, &new);
+
+    // only functions which changed or have no match need linting
+    struct function **pending = malloc((old.nfuncs + new.nfuncs) * sizeof(*pending));
+    size_t npending = 0;
+    size_t identical = 0, changed = 0, added = 0, removed = 0;
+    uint64_t old_size = 0, new_size = 0;
+    for (size_t i = 0; i < old.nfuncs; ++i) {
+        struct function *func = &old.funcs[i];
+        old_size += func->sym->size;
+        if (func->match == NULL) {
+            ++removed;
+        } else if (func->identical) {
+            ++identical;
+            continue;
+        } else {
+            ++changed;
+        }
+        pending[npending++] = func;
+    }
+    for (size_t i = 0; i < new.nfuncs; ++i) {
+        struct function *func = &new.funcs[i];
+        new_size += func->sym->size;
+        if (func->match == NULL) {
+            ++added;
+        } else if (func->identical) {
+            continue;
+        }
+        pending[npending++] = func;
+    }
+
+    parallel_for(npending, jobs, lint_function, pending);
+
+    int old_counts[X86LINT_RULE_COUNT] = { 0 };
+    int new_counts[X86LINT_RULE_COUNT] = { 0 };
+    struct function_delta *deltas = malloc(npending * sizeof(*deltas));
+    size_t ndeltas = 0;
+    for (size_t i = 0; i < npending; ++i) {
+        struct function *func = pending[i];
+        bool is_old = func >= old.funcs && func < old.funcs + old.nfuncs;
+        for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+            (is_old ? old_counts : new_counts)[rule] += func->counts[rule];
+        }
+        // report each pair once, from the new side when it exists
+        if (is_old && func->match != NULL) {
+            continue;
+        }
+        const struct function *o = is_old ? func : func->match;
+        const struct function *n = is_old ? NULL : func;
+        struct function_delta delta = {
+            func->sym->name, o, n,
+            function_errors(n) - function_errors(o),
+            (int64_t) function_size(n) - (int64_t) function_size(o),
+        };
+        if (delta.errors != 0 || delta.size != 0 || o == NULL || n == NULL) {
+            deltas[ndeltas++] = delta;
+        }
+    }
+    qsort(deltas, ndeltas, sizeof(*deltas), compare_deltas);
+
+    int old_errors = 0, new_errors = 0;
+    printf("functions: %zu identical, %zu changed, %zu added, %zu removed\n",
+           identical, changed, added, removed);
+    printf("code size: %" PRIu64 " -> %" PRIu64 " (%+" PRId64 " bytes)\n",
+           old_size, new_size, (int64_t) new_size - (int64_t) old_size);
+    printf("rule deltas in changed functions:\n");
+    for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+        old_errors += old_counts[rule];
+        new_errors += new_counts[rule];
+        if (old_counts[rule] != 0 || new_counts[rule] != 0) {
+            printf("  %s: %d -> %d (%+d)\n", x86lint_rule_name(rule),
+                   old_counts[rule], new_counts[rule], new_counts[rule] - old_counts[rule]);
+        }
+    }
+    printf("function deltas:\n");
+    for (size_t i = 0; i < ndeltas; ++i) {
+        print_function_delta(&deltas[i]);
+    }
+    printf("%d -> %d errors (%+d)\n", old_errors, new_errors, new_errors - old_errors);
+
+    free(deltas);
+    free(pending);
+    close_binary(&new);
+    close_binary(&old);
+    return new_errors > old_errors ? new_errors - old_errors : 0;
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DIFF_H__
+#define __DIFF_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// return a fingerprint of a function's bytes
+uint64_t hash_bytes(const uint8_t *data, size_t len);
+
+// Return a fingerprint of a function's instructions.  RIP-relative and branch
+// displacements which leave the function are replaced by the low bits of their
+// target when targets is true, or by zero otherwise, so that copies of a
+// function at other addresses hash equal.
+uint64_t hash_code(const uint8_t *data, size_t len, uint64_t address, bool targets);
+
+// Lint the functions which differ between two binaries and print per-rule,
+// per-function and code size deltas.  Functions are matched by symbol name,
+// then by content; identical functions are not linted.  Return -1 on error,
+// otherwise the increase in findings, or zero if there is none.
+int diff_files(const char *old_path, const char *new_path, long jobs);
+
+#endif
@@ -0,0 +1,639 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dwarf.h"
+
+#define DW_LNS_copy 1
+#define DW_LNS_advance_pc 2
+#define DW_LNS_advance_line 3
+#define DW_LNS_set_file 4
+#define DW_LNS_const_add_pc 8
+#define DW_LNS_fixed_advance_pc 9
+
+#define DW_LNE_end_sequence 1
+#define DW_LNE_set_address 2
+
+#define DW_LNCT_path 1
+#define DW_LNCT_directory_index 2
+
+#define DW_FORM_block2 0x03
+#define DW_FORM_block4 0x04
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_string 0x08
+#define DW_FORM_block 0x09
+#define DW_FORM_block1 0x0a
+#define DW_FORM_data1 0x0b
+#define DW_FORM_sdata 0x0d
+#define DW_FORM_strp 0x0e
+#define DW_FORM_udata 0x0f
+#define DW_FORM_strx 0x1a
+#define DW_FORM_data16 0x1e
+#define DW_FORM_line_strp 0x1f
+#define DW_FORM_strx1 0x25
+#define DW_FORM_strx2 0x26
+#define DW_FORM_strx3 0x27
+#define DW_FORM_strx4 0x28
+
+struct reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool error;
+};
+
+static const uint8_t *skip(struct reader *r, uint64_t n)
+{
+    if ((uint64_t) (r->end - r->p) < n) {
+        r->error = true;
+        r->p = r->end;
+        return NULL;
+    }
+    const uint8_t *p = r->p;
+    r->p += n;
+    return p;
+}
+
+static uint64_t read_u(struct reader *r, int n)
+{
+    const uint8_t *p = skip(r, n);
+    uint64_t value = 0;
+    if (p == NULL) {
+        return 0;
+    }
+    for (int i = n - 1; i >= 0; --i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static uint64_t read_uleb(struct reader *r)
+{
+    uint64_t value = 0;
+    for (int shift = 0; r->p < r->end; shift += 7) {
+        uint8_t byte = *r->p++;
+        if (shift < 64) {
+            value |= (uint64_t) (byte & 0x7f) << shift;
+        }
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+    r->error = true;
+    return value;
+}
+
+static int64_t read_sleb(struct reader *r)
+{
+    int64_t value = 0;
+    int shift = 0;
+    while (r->p < r->end) {
+        uint8_t byte = *r->p++;
+        if (shift < 64) {
+            value |= (int64_t) (byte & 0x7f) << shift;
+        }
+        shift += 7;
+        if ((byte & 0x80) == 0) {
+            if (shift < 64 && (byte & 0x40)) {
+                value |= -((int64_t) 1 << shift);
+            }
+            return value;
+        }
+    }
+    r->error = true;
+    return value;
+}
+
+static const char *read_str(struct reader *r)
+{
+    const uint8_t *nul = memchr(r->p, '\0', r->end - r->p);
+    if (nul == NULL) {
+        r->error = true;
+        r->p = r->end;
+        return NULL;
+    }
+    const char *s = (const char *) r->p;
+    r->p = nul + 1;
+    return s;
+}
+
+// string sections referenced by DW_FORM_strp and DW_FORM_line_strp
+struct strtab {
+    const char *data;
+    size_t size;
+};
+
+static const char *strtab_get(const struct strtab *tab, uint64_t offset)
+{
+    if (tab->data == NULL || offset >= tab->size ||
+        memchr(tab->data + offset, '\0', tab->size - offset) == NULL) {
+        return NULL;
+    }
+    return tab->data + offset;
+}
+
+static void load_strtab(struct strtab *tab, const struct elf_file *elf, const char *name)
+{
+    const Elf64_Shdr *shdr = elf_find_section(elf, name);
+    tab->data = NULL;
+    tab->size = 0;
+    if (shdr != NULL && (shdr->sh_flags & SHF_COMPRESSED) == 0) {
+        tab->data = (const char *) elf_section_data(elf, shdr);
+        tab->size = tab->data != NULL ? shdr->sh_size : 0;
+    }
+}
+
+// Read one attribute of a DWARF 5 directory or file entry.  Strings are
+// returned in str, everything else in value.
+static void read_form(struct reader *r, uint64_t form, bool dwarf64,
+                      const struct strtab *debug_str, const struct strtab *debug_line_str,
+                      const char **str, uint64_t *value)
+{
+    *str = NULL;
+    *value = 0;
+    switch (form) {
+    case DW_FORM_string:
+        *str = read_str(r);
+        break;
+    case DW_FORM_strp:
+        *str = strtab_get(debug_str, read_u(r, dwarf64 ? 8 : 4));
+        break;
+    case DW_FORM_line_strp:
+        *str = strtab_get(debug_line_str, read_u(r, dwarf64 ? 8 : 4));
+        break;
+    // Resolving a string index needs DW_AT_str_offsets_base from the unit's
+    // entry in .debug_info.  Compilers use DW_FORM_line_strp instead, so such
+    // files are left unnamed and print as ??.
+    case DW_FORM_strx:
+    case DW_FORM_udata:
+        *value = read_uleb(r);
+        break;
+    case DW_FORM_strx1:
+    case DW_FORM_data1:
+        *value = read_u(r, 1);
+        break;
+    case DW_FORM_strx2:
+    case DW_FORM_data2:
+        *value = read_u(r, 2);
+        break;
+    case DW_FORM_strx3:
+        *value = read_u(r, 3);
+        break;
+    case DW_FORM_strx4:
+    case DW_FORM_data4:
+        *value = read_u(r, 4);
+        break;
+    case DW_FORM_data8:
+        *value = read_u(r, 8);
+        break;
+    case DW_FORM_data16:
+        skip(r, 16);
+        break;
+    case DW_FORM_sdata:
+        *value = read_sleb(r);
+        break;
+    case DW_FORM_block:
+        skip(r, read_uleb(r));
+        break;
+    case DW_FORM_block1:
+        skip(r, read_u(r, 1));
+        break;
+    case DW_FORM_block2:
+        skip(r, read_u(r, 2));
+        break;
+    case DW_FORM_block4:
+        skip(r, read_u(r, 4));
+        break;
+    default:
+        r->error = true;
+        break;
+    }
+}
+
+// Interns file names so that each distinct path is stored once across all
+// compilation units.
+struct file_table {
+    struct line_index *index;
+    uint32_t *slots;
+    size_t nslots;
+};
+
+static uint64_t hash_string(const char *s)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (; *s != '\0'; ++s) {
+        hash = (hash ^ (uint8_t) *s) * 0x100000001b3;
+    }
+    return hash;
+}
+
+static uint32_t intern_file(struct file_table *table, const char *dir, const char *name)
+{
+    struct line_index *index = table->index;
+    char *path;
+
+    if (name == NULL) {
+        return 0;
+    }
+    if (name[0] == '/' || dir == NULL || dir[0] == '\0') {
+        path = strdup(name);
+    } else {
+        path = malloc(strlen(dir) + strlen(name) + 2);
+        sprintf(path, "%s/%s", dir, name);
+    }
+
+    if (index->nfiles * 2 >= table->nslots) {
+        size_t nslots = table->nslots == 0 ? 64 : table->nslots * 2;
+        uint32_t *slots = calloc(nslots, sizeof(*slots));
+        for (size_t i = 0; i < table->nslots; ++i) {
+            uint32_t id = table->slots[i];
+            if (id == 0) {
+                continue;
+            }
+            size_t slot = hash_string(index->files[id]) & (nslots - 1);
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & (nslots - 1);
+            }
+            slots[slot] = id;
+        }
+        free(table->slots);
+        table->slots = slots;
+        table->nslots = nslots;
+        index->files = realloc(index->files, nslots / 2 * sizeof(*index->files));
+    }
+
+    size_t slot = hash_string(path) & (table->nslots - 1);
+    while (table->slots[slot] != 0) {
+        uint32_t id = table->slots[slot];
+        if (strcmp(index->files[id], path) == 0) {
+            free(path);
+            return id;
+        }
+        slot = (slot + 1) & (table->nslots - 1);
+    }
+    uint32_t id = index->nfiles++;
+    index->files[id] = path;
+    table->slots[slot] = id;
+    return id;
+}
+
+struct row_buffer {
+    struct line_index *index;
+    size_t capacity;
+    // first row of the current sequence
+    size_t seq_start;
+};
+
+static void emit_row(struct row_buffer *buf, uint64_t address, uint32_t file, uint32_t line)
+{
+    struct line_index *index = buf->index;
+
+    if (index->nrows > buf->seq_start) {
+        struct line_row *prev = &index->rows[index->nrows - 1];
+        // the last row for an address wins
+        if (prev->address == address) {
+            --index->nrows;
+        } else if (line != 0 && prev->file == file && prev->line == line) {
+            return;
+        }
+    }
+    if (index->nrows == buf->capacity) {
+        buf->capacity = buf->capacity == 0 ? 1024 : buf->capacity * 2;
+        index->rows = realloc(index->rows, buf->capacity * sizeof(*index->rows));
+    }
+    index->rows[index->nrows++] = (struct line_row) { address, file, line };
+}
+
+static void end_sequence(struct row_buffer *buf, uint64_t address, bool discard)
+{
+    if (discard) {
+        buf->index->nrows = buf->seq_start;
+    } else if (buf->index->nrows > buf->seq_start) {
+        emit_row(buf, address, 0, 0);
+    }
+    buf->seq_start = buf->index->nrows;
+}
+
+// Parse one line number program and append its rows.  Return a pointer past
+// the unit or NULL on malformed input.
+static const uint8_t *parse_unit(struct reader *unit_reader, struct file_table *files,
+                                 struct row_buffer *buf, bool relocatable,
+                                 const struct strtab *debug_str,
+                                 const struct strtab *debug_line_str)
+{
+    bool dwarf64 = false;
+    uint64_t unit_length = read_u(unit_reader, 4);
+    if (unit_length == 0xffffffff) {
+        dwarf64 = true;
+        unit_length = read_u(unit_reader, 8);
+    }
+    const uint8_t *unit_start = skip(unit_reader, unit_length);
+    if (unit_start == NULL) {
+        return NULL;
+    }
+    struct reader r = { unit_start, unit_start + unit_length, false };
+
+    uint16_t version = read_u(&r, 2);
+    if (version < 2 || version > 5) {
+        return unit_reader->p;
+    }
+    if (version >= 5) {
+        read_u(&r, 1);  // address_size
+        read_u(&r, 1);  // segment_selector_size
+    }
+    uint64_t header_length = read_u(&r, dwarf64 ? 8 : 4);
+    if (header_length > (uint64_t) (r.end - r.p)) {
+        return NULL;
+    }
+    const uint8_t *program = r.p + header_length;
+    uint8_t min_inst_length = read_u(&r, 1);
+    if (version >= 4) {
+        read_u(&r, 1);  // maximum_operations_per_instruction
+    }
+    read_u(&r, 1);  // default_is_stmt
+    int8_t line_base = read_u(&r, 1);
+    uint8_t line_range = read_u(&r, 1);
+    uint8_t opcode_base = read_u(&r, 1);
+    const uint8_t *opcode_lengths = skip(&r, opcode_base > 0 ? opcode_base - 1 : 0);
+    if (r.error || line_range == 0) {
+        return NULL;
+    }
+
+    // map from the unit's file numbers to interned file ids
+    uint32_t *unit_files = NULL;
+    size_t nunit_files = 0;
+
+    if (version >= 5) {
+        const char **dirs = NULL;
+        size_t ndirs = 0;
+
+        for (int pass = 0; pass < 2 && !r.error; ++pass) {
+            uint8_t format_count = read_u(&r, 1);
+            uint64_t formats[2 * 256];
+            for (int i = 0; i < format_count; ++i) {
+                formats[2 * i] = read_uleb(&r);
+                formats[2 * i + 1] = read_uleb(&r);
+            }
+            uint64_t count = read_uleb(&r);
+            if (count > (uint64_t) (r.end - r.p)) {
+                r.error = true;
+                break;
+            }
+            if (pass == 0) {
+                dirs = calloc(count, sizeof(*dirs));
+                ndirs = count;
+            } else {
+                unit_files = calloc(count, sizeof(*unit_files));
+                nunit_files = count;
+            }
+            for (uint64_t entry = 0; entry < count && !r.error; ++entry) {
+                const char *path = NULL;
+                uint64_t dir_index = 0;
+                for (int i = 0; i < format_count; ++i) {
+                    const char *str;
+                    uint64_t value;
+                    read_form(&r, formats[2 * i + 1], dwarf64, debug_str, debug_line_str,
+                              &str, &value);
+                    if (formats[2 * i] == DW_LNCT_path) {
+                        path = str;
+                    } else if (formats[2 * i] == DW_LNCT_directory_index) {
+                        dir_index = value;
+                    }
+                }
+                if (pass == 0) {
+                    dirs[entry] = path;
+                } else {
+                    unit_files[entry] = intern_file(files, dir_index < ndirs ? dirs[dir_index] : NULL, path);
+                }
+            }
+        }
+        free(dirs);
+    } else {
+        const char **dirs = NULL;
+        size_t ndirs = 0;
+        size_t capacity = 0;
+
+        // directory 0 is the compilation directory which DWARF 4 does not record here
+        dirs = malloc(sizeof(*dirs));
+        dirs[ndirs++] = NULL;
+        capacity = 1;
+        for (;;) {
+            const char *dir = read_str(&r);
+            if (dir == NULL || dir[0] == '\0') {
+                break;
+            }
+            if (ndirs == capacity) {
+                capacity *= 2;
+                dirs = realloc(dirs, capacity * sizeof(*dirs));
+            }
+            dirs[ndirs++] = dir;
+        }
+        // file 0 is unused before DWARF 5
+        capacity = 16;
+        unit_files = malloc(capacity * sizeof(*unit_files));
+        unit_files[nunit_files++] = 0;
+        for (;;) {
+            const char *name = read_str(&r);
+            if (name == NULL || name[0] == '\0') {
+                break;
+            }
+            uint64_t dir_index = read_uleb(&r);
+            read_uleb(&r);  // modification time
+            read_uleb(&r);  // length
+            if (nunit_files == capacity) {
+                capacity *= 2;
+                unit_files = realloc(unit_files, capacity * sizeof(*unit_files));
+            }
+            unit_files[nunit_files++] = intern_file(files, dir_index < ndirs ? dirs[dir_index] : NULL, name);
+        }
+        free(dirs);
+    }
+
+    if (r.error) {
+        free(unit_files);
+        return NULL;
+    }
+
+    r.p = program;
+    uint64_t address = 0;
+    uint64_t file = 1;
+    int64_t line = 1;
+    bool discard = false;
+
+#define FILE_ID() (file < nunit_files ? unit_files[file] : 0)
+
+    while (r.p < r.end && !r.error) {
+        uint8_t opcode = read_u(&r, 1);
+        if (opcode >= opcode_base) {
+            uint8_t adjusted = opcode - opcode_base;
+            address += (uint64_t) (adjusted / line_range) * min_inst_length;
+            line += line_base + adjusted % line_range;
+            emit_row(buf, address, FILE_ID(), line);
+            continue;
+        }
+        switch (opcode) {
+        case 0: {
+            uint64_t len = read_uleb(&r);
+            const uint8_t *ext = skip(&r, len);
+            if (ext == NULL || len == 0) {
+                break;
+            }
+            struct reader er = { ext + 1, ext + len, false };
+            switch (ext[0]) {
+            case DW_LNE_end_sequence:
+                end_sequence(buf, address, discard);
+                address = 0;
+                file = 1;
+                line = 1;
+                discard = false;
+                break;
+            case DW_LNE_set_address:
+                address = read_u(&er, len - 1 > 8 ? 8 : len - 1);
+                // linkers point discarded functions at 0 or -1
+                if (!relocatable && buf->index->nrows == buf->seq_start &&
+                    (address == 0 || address == UINT64_MAX || address == UINT32_MAX)) {
+                    discard = true;
+                }
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+        case DW_LNS_copy:
+            emit_row(buf, address, FILE_ID(), line);
+            break;
+        case DW_LNS_advance_pc:
+            address += read_uleb(&r) * min_inst_length;
+            break;
+        case DW_LNS_advance_line:
+            line += read_sleb(&r);
+            break;
+        case DW_LNS_set_file:
+            file = read_uleb(&r);
+            break;
+        case DW_LNS_const_add_pc:
+            address += (uint64_t) ((255 - opcode_base) / line_range) * min_inst_length;
+            break;
+        case DW_LNS_fixed_advance_pc:
+            address += read_u(&r, 2);
+            break;
+        default:
+            for (int i = 0; i < opcode_lengths[opcode - 1]; ++i) {
+                read_uleb(&r);
+            }
+            break;
+        }
+    }
+
+#undef FILE_ID
+
+    // drop a trailing sequence without DW_LNE_end_sequence
+    buf->index->nrows = buf->seq_start;
+    free(unit_files);
+    return unit_reader->p;
+}
+
+static int compare_rows(const void *a, const void *b)
+{
+    const struct line_row *x = a;
+    const struct line_row *y = b;
+
+    if (x->address != y->address) {
+        return x->address < y->address ? -1 : 1;
+    }
+    // the end of one sequence sorts before the start of the next
+    return (x->line != 0) - (y->line != 0);
+}
+
+int line_index_build(struct line_index *index, const struct elf_file *elf)
+{
+    memset(index, 0, sizeof(*index));
+
+    const Elf64_Shdr *shdr = elf_find_section(elf, ".debug_line");
+    if (shdr == NULL) {
+        return -1;
+    }
+    if (shdr->sh_flags & SHF_COMPRESSED) {
+        fprintf(stderr, "compressed .debug_line is not supported\n");
+        return -1;
+    }
+    const uint8_t *data = elf_section_data(elf, shdr);
+    if (data == NULL) {
+        return -1;
+    }
+
+    struct strtab debug_str, debug_line_str;
+    load_strtab(&debug_str, elf, ".debug_str");
+    load_strtab(&debug_line_str, elf, ".debug_line_str");
+
+    struct file_table files = { index, NULL, 0 };
+    struct row_buffer buf = { index, 0, 0 };
+    intern_file(&files, NULL, "??");
+
+    struct reader r = { data, data + shdr->sh_size, false };
+    bool relocatable = elf->ehdr->e_type == ET_REL;
+    while (r.p < r.end) {
+        if (parse_unit(&r, &files, &buf, relocatable, &debug_str, &debug_line_str) == NULL) {
+            fprintf(stderr, "malformed .debug_line\n");
+            break;
+        }
+    }
+    free(files.slots);
+
+    if (index->nrows == 0) {
+        line_index_free(index);
+        return -1;
+    }
+    qsort(index->rows, index->nrows, sizeof(*index->rows), compare_rows);
+    index->rows = realloc(index->rows, index->nrows * sizeof(*index->rows));
+    return 0;
+}
+
+void line_index_free(struct line_index *index)
+{
+    for (size_t i = 0; i < index->nfiles; ++i) {
+        free(index->files[i]);
+    }
+    free(index->files);
+    free(index->rows);
+    memset(index, 0, sizeof(*index));
+}
+
+const struct line_row *line_index_lookup(const struct line_index *index, uint64_t address)
+{
+    size_t lo = 0;
+    size_t hi = index->nrows;
+
+    // find the last row at or before address
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->rows[mid].address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || index->rows[lo - 1].line == 0) {
+        return NULL;
+    }
+    return &index->rows[lo - 1];
+}
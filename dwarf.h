@@ -0,0 +1,49 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DWARF_H__
+#define __DWARF_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "elffile.h"
+
+struct line_row {
+    uint64_t address;
+    uint32_t file;
+    // zero marks the end of a sequence
+    uint32_t line;
+};
+
+// Address to source line index built once from .debug_line.  Rows are sorted
+// by address and each row covers addresses up to the next row.
+struct line_index {
+    struct line_row *rows;
+    size_t nrows;
+    char **files;
+    size_t nfiles;
+};
+
+// build the index from .debug_line; return -1 if the file has no usable line table
+int line_index_build(struct line_index *index, const struct elf_file *elf);
+
+void line_index_free(struct line_index *index);
+
+// return the row covering address or NULL
+const struct line_row *line_index_lookup(const struct line_index *index, uint64_t address);
+
+#endif
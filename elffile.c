@@ -0,0 +1,421 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "elffile.h"
+
+static bool in_bounds(const struct elf_file *elf, uint64_t offset, uint64_t size)
+{
+    return offset <= elf->size && size <= elf->size - offset;
+}
+
+int elf_init(struct elf_file *elf, const uint8_t *data, size_t size)
+{
+    memset(elf, 0, sizeof(*elf));
+    elf->data = data;
+    elf->size = size;
+
+    if (size < sizeof(Elf64_Ehdr) || memcmp(data, ELFMAG, SELFMAG) != 0) {
+        fprintf(stderr, "not an ELF file\n");
+        return -1;
+    }
+    elf->ehdr = (const Elf64_Ehdr *) data;
+    if (elf->ehdr->e_ident[EI_CLASS] != ELFCLASS64 || elf->ehdr->e_machine != EM_X86_64) {
+        fprintf(stderr, "not an x86-64 ELF file\n");
+        return -1;
+    }
+
+    if (elf->ehdr->e_shnum > 0 &&
+        elf->ehdr->e_shentsize == sizeof(Elf64_Shdr) &&
+        in_bounds(elf, elf->ehdr->e_shoff, (uint64_t) elf->ehdr->e_shnum * sizeof(Elf64_Shdr))) {
+        elf->shdrs = (const Elf64_Shdr *) (data + elf->ehdr->e_shoff);
+        elf->shnum = elf->ehdr->e_shnum;
+        if (elf->ehdr->e_shstrndx < elf->shnum) {
+            const Elf64_Shdr *strtab = &elf->shdrs[elf->ehdr->e_shstrndx];
+            if (in_bounds(elf, strtab->sh_offset, strtab->sh_size)) {
+                elf->shstrtab = (const char *) data + strtab->sh_offset;
+                elf->shstrtab_size = strtab->sh_size;
+            }
+        }
+    }
+
+    if (elf->ehdr->e_phnum > 0 &&
+        elf->ehdr->e_phentsize == sizeof(Elf64_Phdr) &&
+        in_bounds(elf, elf->ehdr->e_phoff, (uint64_t) elf->ehdr->e_phnum * sizeof(Elf64_Phdr))) {
+        elf->phdrs = (const Elf64_Phdr *) (data + elf->ehdr->e_phoff);
+        elf->phnum = elf->ehdr->e_phnum;
+    }
+
+    return 0;
+}
+
+int map_file(const char *path, const uint8_t **data, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Error opening file");
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("Error reading file");
+        close(fd);
+        return -1;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("Error mapping file");
+        return -1;
+    }
+    *data = mapping;
+    *size = st.st_size;
+    return 0;
+}
+
+void unmap_file(const uint8_t *data, size_t size)
+{
+    munmap((void *) data, size);
+}
+
+int elf_open(struct elf_file *elf, const char *path)
+{
+    const uint8_t *data;
+    size_t size;
+
+    if (map_file(path, &data, &size) == -1) {
+        return -1;
+    }
+    if (elf_init(elf, data, size) == -1) {
+        unmap_file(data, size);
+        return -1;
+    }
+    elf->mapping = (void *) data;
+    elf->mapping_size = size;
+    return 0;
+}
+
+void elf_close(struct elf_file *elf)
+{
+    if (elf->mapping != NULL) {
+        unmap_file(elf->mapping, elf->mapping_size);
+    }
+    memset(elf, 0, sizeof(*elf));
+}
+
+const char *elf_section_name(const struct elf_file *elf, const Elf64_Shdr *shdr)
+{
+    if (elf->shstrtab == NULL || shdr->sh_name >= elf->shstrtab_size ||
+        memchr(elf->shstrtab + shdr->sh_name, '\0', elf->shstrtab_size - shdr->sh_name) == NULL) {
+        return "";
+    }
+    return elf->shstrtab + shdr->sh_name;
+}
+
+const Elf64_Shdr *elf_find_section(const struct elf_file *elf, const char *name)
+{
+    for (size_t i = 0; i < elf->shnum; ++i) {
+        if (strcmp(elf_section_name(elf, &elf->shdrs[i]), name) == 0) {
+            return &elf->shdrs[i];
+        }
+    }
+    return NULL;
+}
+
+const uint8_t *elf_section_data(const struct elf_file *elf, const Elf64_Shdr *shdr)
+{
+    if (shdr->sh_type == SHT_NOBITS || !in_bounds(elf, shdr->sh_offset, shdr->sh_size)) {
+        return NULL;
+    }
+    return elf->data + shdr->sh_offset;
+}
+
+const uint8_t *elf_segment_data(const struct elf_file *elf, const Elf64_Phdr *phdr)
+{
+    if (!in_bounds(elf, phdr->p_offset, phdr->p_filesz)) {
+        return NULL;
+    }
+    return elf->data + phdr->p_offset;
+}
+
+static int compare_offsets(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+uint64_t *elf_section_relocations(const struct elf_file *elf, const Elf64_Shdr *shdr, size_t *count)
+{
+    size_t target = shdr - elf->shdrs;
+    uint64_t *offsets = NULL;
+    size_t n = 0;
+
+    for (size_t i = 0; i < elf->shnum; ++i) {
+        const Elf64_Shdr *rel = &elf->shdrs[i];
+        size_t entsize;
+        if (rel->sh_type == SHT_RELA) {
+            entsize = sizeof(Elf64_Rela);
+        } else if (rel->sh_type == SHT_REL) {
+            entsize = sizeof(Elf64_Rel);
+        } else {
+            continue;
+        }
+        const uint8_t *data = elf_section_data(elf, rel);
+        if (rel->sh_info != target || data == NULL) {
+            continue;
+        }
+        size_t nrel = rel->sh_size / entsize;
+        offsets = realloc(offsets, (n + nrel) * sizeof(*offsets));
+        for (size_t j = 0; j < nrel; ++j) {
+            // r_offset is the first member of both Elf64_Rel and Elf64_Rela
+            memcpy(&offsets[n++], data + j * entsize, sizeof(uint64_t));
+        }
+    }
+
+    qsort(offsets, n, sizeof(*offsets), compare_offsets);
+    *count = n;
+    return offsets;
+}
+
+static int compare_symbols(const void *a, const void *b)
+{
+    const struct elf_symbol *x = a;
+    const struct elf_symbol *y = b;
+
+    if (x->address != y->address) {
+        return x->address < y->address ? -1 : 1;
+    }
+    // prefer the longer of two aliases, then a stable name order
+    if (x->size != y->size) {
+        return x->size > y->size ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+ssize_t elf_functions(const struct elf_file *elf, struct elf_symbol **symbols)
+{
+    const Elf64_Shdr *symtab = NULL;
+    *symbols = NULL;
+
+    for (size_t i = 0; i < elf->shnum && symtab == NULL; ++i) {
+        if (elf->shdrs[i].sh_type == SHT_SYMTAB) {
+            symtab = &elf->shdrs[i];
+        }
+    }
+    for (size_t i = 0; i < elf->shnum && symtab == NULL; ++i) {
+        if (elf->shdrs[i].sh_type == SHT_DYNSYM) {
+            symtab = &elf->shdrs[i];
+        }
+    }
+    if (symtab == NULL || symtab->sh_link >= elf->shnum) {
+        return -1;
+    }
+    const Elf64_Sym *syms = (const Elf64_Sym *) elf_section_data(elf, symtab);
+    const Elf64_Shdr *strtab = &elf->shdrs[symtab->sh_link];
+    const char *names = (const char *) elf_section_data(elf, strtab);
+    if (syms == NULL || names == NULL) {
+        return -1;
+    }
+
+    size_t nsyms = symtab->sh_size / sizeof(Elf64_Sym);
+    size_t count = 0;
+    struct elf_symbol *result = malloc(nsyms * sizeof(*result));
+    for (size_t i = 0; i < nsyms; ++i) {
+        const Elf64_Sym *sym = &syms[i];
+        if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC || sym->st_size == 0 ||
+            sym->st_shndx == SHN_UNDEF || sym->st_shndx >= elf->shnum ||
+            sym->st_name >= strtab->sh_size) {
+            continue;
+        }
+        const Elf64_Shdr *shdr = &elf->shdrs[sym->st_shndx];
+        const uint8_t *data = elf_section_data(elf, shdr);
+        // st_value is an offset into the section in relocatable objects
+        uint64_t offset = elf->ehdr->e_type == ET_REL ? sym->st_value : sym->st_value - shdr->sh_addr;
+        if (data == NULL || offset > shdr->sh_size || sym->st_size > shdr->sh_size - offset ||
+            memchr(names + sym->st_name, '\0', strtab->sh_size - sym->st_name) == NULL) {
+            continue;
+        }
+        result[count++] = (struct elf_symbol) {
+            names + sym->st_name, sym->st_value, sym->st_size, data + offset,
+        };
+    }
+
+    qsort(result, count, sizeof(*result), compare_symbols);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (unique > 0 && result[unique - 1].address == result[i].address) {
+            continue;
+        }
+        result[unique++] = result[i];
+    }
+
+    if (unique == 0) {
+        free(result);
+        return -1;
+    }
+    *symbols = result;
+    return unique;
+}
+
+const struct elf_symbol *elf_function_at(const struct elf_symbol *symbols, size_t count, uint64_t address)
+{
+    size_t lo = 0;
+    size_t hi = count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (symbols[mid].address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || address - symbols[lo - 1].address >= symbols[lo - 1].size) {
+        return NULL;
+    }
+    return &symbols[lo - 1];
+}
+
+#define AR_MAGIC "!<arch>\n"
+#define AR_MAGIC_SIZE 8
+
+struct ar_header {
+    char name[16];
+    char date[12];
+    char uid[6];
+    char gid[6];
+    char mode[8];
+    char size[10];
+    char fmag[2];
+};
+
+bool ar_is_archive(const uint8_t *data, size_t size)
+{
+    return size >= AR_MAGIC_SIZE && memcmp(data, AR_MAGIC, AR_MAGIC_SIZE) == 0;
+}
+
+static uint64_t parse_decimal(const char *s, size_t len)
+{
+    uint64_t value = 0;
+    for (size_t i = 0; i < len && isdigit((unsigned char) s[i]); ++i) {
+        value = value * 10 + (s[i] - '0');
+    }
+    return value;
+}
+
+ssize_t ar_members(const uint8_t *data, size_t size, struct ar_member **members)
+{
+    const char *long_names = NULL;
+    size_t long_names_size = 0;
+    size_t count = 0;
+    size_t capacity = 0;
+    size_t offset = AR_MAGIC_SIZE;
+
+    *members = NULL;
+    if (!ar_is_archive(data, size)) {
+        return -1;
+    }
+
+    while (offset + sizeof(struct ar_header) <= size) {
+        const struct ar_header *hdr = (const struct ar_header *) (data + offset);
+        if (memcmp(hdr->fmag, "`\n", 2) != 0) {
+            goto malformed;
+        }
+        uint64_t member_size = parse_decimal(hdr->size, sizeof(hdr->size));
+        offset += sizeof(*hdr);
+        if (member_size > size - offset) {
+            goto malformed;
+        }
+        const uint8_t *member = data + offset;
+        char *name = NULL;
+
+        if (memcmp(hdr->name, "/ ", 2) == 0 || memcmp(hdr->name, "/SYM64/ ", 8) == 0 ||
+            memcmp(hdr->name, "__.SYMDEF", 9) == 0) {
+            // symbol table
+        } else if (memcmp(hdr->name, "// ", 3) == 0) {
+            long_names = (const char *) member;
+            long_names_size = member_size;
+        } else if (hdr->name[0] == '/' && isdigit((unsigned char) hdr->name[1])) {
+            // GNU long name terminated by "/\n"
+            uint64_t name_offset = parse_decimal(hdr->name + 1, sizeof(hdr->name) - 1);
+            if (long_names == NULL || name_offset >= long_names_size) {
+                goto malformed;
+            }
+            size_t len = 0;
+            while (name_offset + len < long_names_size && long_names[name_offset + len] != '\n') {
+                ++len;
+            }
+            if (len > 0 && long_names[name_offset + len - 1] == '/') {
+                --len;
+            }
+            name = strndup(long_names + name_offset, len);
+        } else if (memcmp(hdr->name, "#1/", 3) == 0) {
+            // BSD long name stored at the start of the member
+            uint64_t len = parse_decimal(hdr->name + 3, sizeof(hdr->name) - 3);
+            if (len > member_size) {
+                goto malformed;
+            }
+            name = strndup((const char *) member, len);
+            member += len;
+            member_size -= len;
+        } else {
+            size_t len = sizeof(hdr->name);
+            while (len > 0 && (hdr->name[len - 1] == ' ' || hdr->name[len - 1] == '/')) {
+                --len;
+            }
+            name = strndup(hdr->name, len);
+        }
+
+        if (name != NULL) {
+            if (count == capacity) {
+                capacity = capacity == 0 ? 16 : capacity * 2;
+                *members = realloc(*members, capacity * sizeof(**members));
+            }
+            (*members)[count++] = (struct ar_member) { name, member, member_size };
+        }
+
+        offset = member - data + member_size;
+        // members are aligned to two bytes
+        offset += offset & 1;
+    }
+
+    return count;
+
+malformed:
+    fprintf(stderr, "malformed archive\n");
+    ar_free(*members, count);
+    *members = NULL;
+    return -1;
+}
+
+void ar_free(struct ar_member *members, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        free(members[i].name);
+    }
+    free(members);
+}
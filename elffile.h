@@ -0,0 +1,102 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ELFFILE_H__
+#define __ELFFILE_H__
+
+#include <elf.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// A 64-bit ELF image in memory.  All pointers are bounds checked against size.
+struct elf_file {
+    const uint8_t *data;
+    size_t size;
+    const Elf64_Ehdr *ehdr;
+    const Elf64_Shdr *shdrs;
+    size_t shnum;
+    const char *shstrtab;
+    size_t shstrtab_size;
+    const Elf64_Phdr *phdrs;
+    size_t phnum;
+    // non-NULL when elf_open mapped the file
+    void *mapping;
+    size_t mapping_size;
+};
+
+// map the file at path read-only; return -1 and print an error on failure
+int map_file(const char *path, const uint8_t **data, size_t *size);
+
+void unmap_file(const uint8_t *data, size_t size);
+
+// map and parse the file at path; return -1 and print an error on failure
+int elf_open(struct elf_file *elf, const char *path);
+
+// parse an image already in memory, e.g., an archive member; return -1 on failure
+int elf_init(struct elf_file *elf, const uint8_t *data, size_t size);
+
+void elf_close(struct elf_file *elf);
+
+// return the name of a section or "" if it has none
+const char *elf_section_name(const struct elf_file *elf, const Elf64_Shdr *shdr);
+
+// return the first section with the given name or NULL
+const Elf64_Shdr *elf_find_section(const struct elf_file *elf, const char *name);
+
+// return the contents of a section or NULL if it has none or is out of bounds
+const uint8_t *elf_section_data(const struct elf_file *elf, const Elf64_Shdr *shdr);
+
+// return the contents of a segment or NULL if it is out of bounds
+const uint8_t *elf_segment_data(const struct elf_file *elf, const Elf64_Phdr *phdr);
+
+// return the sorted offsets of fields which relocations patch in a section
+// of a relocatable object; the caller frees the array
+uint64_t *elf_section_relocations(const struct elf_file *elf, const Elf64_Shdr *shdr, size_t *count);
+
+struct elf_symbol {
+    const char *name;
+    uint64_t address;
+    uint64_t size;
+    // contents of the function in the file
+    const uint8_t *data;
+};
+
+// return the functions defined in .symtab, or .dynsym if the file is
+// stripped, sorted by address with aliases removed, or -1 if there are none;
+// the caller frees the array
+ssize_t elf_functions(const struct elf_file *elf, struct elf_symbol **symbols);
+
+// return the function containing address or NULL
+const struct elf_symbol *elf_function_at(const struct elf_symbol *symbols, size_t count, uint64_t address);
+
+struct ar_member {
+    char *name;
+    const uint8_t *data;
+    size_t size;
+};
+
+// return true if data starts with the ar(1) archive magic
+bool ar_is_archive(const uint8_t *data, size_t size);
+
+// return the members of an archive, excluding the symbol and long name
+// tables, or -1 if malformed; the caller frees with ar_free
+ssize_t ar_members(const uint8_t *data, size_t size, struct ar_member **members);
+
+void ar_free(struct ar_member *members, size_t count);
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "forwarding.h"
+#include "xed/xed-interface.h"
+
+// stores a load may still forward from
+#define MAX_STORES 8
+#define MAX_WRITTEN_REGS 16
+
+// symbolic [seg:base+index*scale+disp] address and access size
+struct mem_ref {
+    xed_reg_enum_t seg;
+    xed_reg_enum_t base;
+    xed_reg_enum_t index;
+    unsigned scale;
+    int64_t disp;
+    unsigned size;
+};
+
+struct store {
+    struct mem_ref ref;
+    uint64_t address;
+    // register which still holds the stored value or XED_REG_INVALID
+    xed_reg_enum_t source;
+};
+
+struct forwarding {
+    FILE *out;
+    void (*on_finding)(void *arg, uint64_t address);
+    void *arg;
+    int errors;
+    // oldest first
+    struct store stores[MAX_STORES];
+    size_t nstores;
+};
+
+static void report(struct forwarding *f, const char *message, uint64_t address, const char *detail)
+{
+    fprintf(f->out, "%s at address: 0x%" PRIx64 "\n%s\n", message, address, detail);
+    if (f->on_finding != NULL) {
+        f->on_finding(f->arg, address);
+    }
+    fprintf(f->out, "\n");
+    ++f->errors;
+}
+
+static struct mem_ref decode_mem_ref(const xed_decoded_inst_t *xedd, unsigned i, const struct cfg_inst *inst)
+{
+    struct mem_ref ref = {
+        xed_decoded_inst_get_seg_reg(xedd, i),
+        xed_decoded_inst_get_base_reg(xedd, i),
+        xed_decoded_inst_get_index_reg(xedd, i),
+        xed_decoded_inst_get_scale(xedd, i),
+        xed_decoded_inst_get_memory_displacement(xedd, i),
+        xed_decoded_inst_get_memory_operand_length(xedd, i),
+    };
+    // RIP-relative operands at different addresses name the same location
+    if (ref.base == XED_REG_RIP) {
+        ref.disp += inst->address + inst->length;
+    }
+    return ref;
+}
+
+static bool same_expression(const struct mem_ref *a, const struct mem_ref *b)
+{
+    return a->seg == b->seg && a->base == b->base && a->index == b->index && a->scale == b->scale;
+}
+
+static bool overlaps(const struct mem_ref *a, const struct mem_ref *b)
+{
+    return a->disp < b->disp + b->size && b->disp < a->disp + a->size;
+}
+
+static bool contains(const struct mem_ref *outer, const struct mem_ref *inner)
+{
+    return outer->disp <= inner->disp && inner->disp + inner->size <= outer->disp + outer->size;
+}
+
+static bool same_register(xed_reg_enum_t a, xed_reg_enum_t b)
+{
+    return a != XED_REG_INVALID && b != XED_REG_INVALID &&
+           xed_get_largest_enclosing_register(a) == xed_get_largest_enclosing_register(b);
+}
+
+static void remove_store(struct forwarding *f, size_t i)
+{
+    for (size_t j = i + 1; j < f->nstores; ++j) {
+        f->stores[j - 1] = f->stores[j];
+    }
+    --f->nstores;
+}
+
+// return the register a MOV stores to memory operand 0, or XED_REG_INVALID
+static xed_reg_enum_t stored_register(const xed_decoded_inst_t *xedd)
+{
+    if (xed_decoded_inst_get_iclass(xedd) != XED_ICLASS_MOV || !xed_decoded_inst_mem_written(xedd, 0)) {
+        return XED_REG_INVALID;
+    }
+    return xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG0);
+}
+
+// return the register a MOV loads from memory operand 0, or XED_REG_INVALID
+static xed_reg_enum_t loaded_register(const xed_decoded_inst_t *xedd)
+{
+    if (xed_decoded_inst_get_iclass(xedd) != XED_ICLASS_MOV || !xed_decoded_inst_mem_read(xedd, 0)) {
+        return XED_REG_INVALID;
+    }
+    return xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG0);
+}
+
+static void check_loads(struct forwarding *f, const xed_decoded_inst_t *xedd, const struct cfg_inst *inst)
+{
+    for (unsigned i = 0; i < xed_decoded_inst_number_of_memory_operands(xedd); ++i) {
+        if (!xed_decoded_inst_mem_read(xedd, i)) {
+            continue;
+        }
+        struct mem_ref load = decode_mem_ref(xedd, i, inst);
+
+        // the youngest overlapping store supplies the value
+        for (size_t j = f->nstores; j-- > 0;) {
+            const struct store *store = &f->stores[j];
+            if (!same_expression(&store->ref, &load) || !overlaps(&store->ref, &load)) {
+                continue;
+            }
+
+            char detail[96];
+            if (!contains(&store->ref, &load)) {
+                snprintf(detail, sizeof(detail), "%u-byte load overlaps %u-byte store at 0x%" PRIx64,
+                         load.size, store->ref.size, store->address);
+                report(f, "store forwarding stall", inst->address, detail);
+            } else if (i == 0 && store->source != XED_REG_INVALID && store->ref.disp == load.disp &&
+                       store->ref.size == load.size && loaded_register(xedd) != XED_REG_INVALID) {
+                snprintf(detail, sizeof(detail), "%s still holds the value stored at 0x%" PRIx64,
+                         xed_reg_enum_t2str(store->source), store->address);
+                report(f, "redundant reload", inst->address, detail);
+            }
+            break;
+        }
+    }
+}
+
+static size_t written_registers(const xed_decoded_inst_t *xedd, xed_reg_enum_t *regs)
+{
+    const xed_inst_t *xi = xed_decoded_inst_inst(xedd);
+    size_t count = 0;
+
+    for (unsigned i = 0; i < xed_inst_noperands(xi) && count < MAX_WRITTEN_REGS; ++i) {
+        const xed_operand_t *op = xed_inst_operand(xi, i);
+        xed_operand_enum_t name = xed_operand_name(op);
+        // PUSH, POP, LEAVE and ENTER update RSP through an implicit base register
+        if ((xed_operand_is_register(name) || xed_operand_is_memory_addressing_register(name)) &&
+            xed_operand_written(op)) {
+            regs[count++] = xed_decoded_inst_get_reg(xedd, name);
+        }
+    }
+    return count;
+}
+
+static bool writes_register(const xed_reg_enum_t *regs, size_t nregs, xed_reg_enum_t reg)
+{
+    for (size_t i = 0; i < nregs; ++i) {
+        if (same_register(regs[i], reg)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void update_stores(struct forwarding *f, const xed_decoded_inst_t *xedd, const struct cfg_inst *inst)
+{
+    xed_reg_enum_t regs[MAX_WRITTEN_REGS];
+    size_t nregs = written_registers(xedd, regs);
+
+    // a store through a changed base or index names a different location
+    for (size_t j = f->nstores; j-- > 0;) {
+        struct store *store = &f->stores[j];
+        if (writes_register(regs, nregs, store->ref.base) || writes_register(regs, nregs, store->ref.index)) {
+            remove_store(f, j);
+        } else if (writes_register(regs, nregs, store->source)) {
+            store->source = XED_REG_INVALID;
+        }
+    }
+
+    for (unsigned i = 0; i < xed_decoded_inst_number_of_memory_operands(xedd); ++i) {
+        if (!xed_decoded_inst_mem_written(xedd, i)) {
+            continue;
+        }
+        struct store store = { decode_mem_ref(xedd, i, inst), inst->address, XED_REG_INVALID };
+
+        // other address expressions may alias
+        for (size_t j = f->nstores; j-- > 0;) {
+            if (!same_expression(&f->stores[j].ref, &store.ref) || overlaps(&f->stores[j].ref, &store.ref)) {
+                remove_store(f, j);
+            }
+        }
+        if (writes_register(regs, nregs, store.ref.base) || writes_register(regs, nregs, store.ref.index)) {
+            continue;
+        }
+        if (i == 0 && !writes_register(regs, nregs, stored_register(xedd))) {
+            store.source = stored_register(xedd);
+        }
+        if (f->nstores == MAX_STORES) {
+            remove_store(f, 0);
+        }
+        f->stores[f->nstores++] = store;
+    }
+}
+
+int check_forwarding(const struct cfg *cfg, FILE *out, void (*on_finding)(void *arg, uint64_t address), void *arg)
+{
+    struct forwarding f = { out, on_finding, arg, 0 };
+
+    for (size_t b = 0; b < cfg->nblocks; ++b) {
+        const struct cfg_block *block = &cfg->blocks[b];
+        f.nstores = 0;
+
+        for (size_t i = block->first; i < block->first + block->count; ++i) {
+            const struct cfg_inst *inst = &cfg->insts[i];
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero(&xedd);
+            xed_decoded_inst_set_mode(&xedd, XED_MACHINE_MODE_LONG_64, XED_ADDRESS_WIDTH_64b);
+            // callees may write any memory
+            if (xed_decode(&xedd, cfg_inst_bytes(cfg, inst), inst->length) != XED_ERROR_NONE ||
+                xed_decoded_inst_get_iclass(&xedd) == XED_ICLASS_CALL_NEAR) {
+                f.nstores = 0;
+                continue;
+            }
+            check_loads(&f, &xedd, inst);
+            update_stores(&f, &xedd, inst);
+        }
+    }
+    return f.errors;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __FORWARDING_H__
+#define __FORWARDING_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cfg.h"
+
+// Print memory accesses within each basic block which reload a value still
+// held in the register that stored it, or which load more bytes than a
+// recent store to the same address wrote and so cannot be forwarded from the
+// store buffer.  Call on_finding, if non-NULL, after each.  Return the number
+// of problems.
+int check_forwarding(const struct cfg *cfg, FILE *out, void (*on_finding)(void *arg, uint64_t address), void *arg);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diff.h"
+#include "icf.h"
+#include "parallel.h"
+
+// names printed per group of identical functions
+#define MAX_GROUP_NAMES 4
+
+struct icf_function {
+    const struct elf_symbol *sym;
+    uint64_t hash;
+};
+
+struct icf_group {
+    // first function in the sorted array and number of copies
+    size_t first;
+    size_t count;
+    uint64_t reclaimed;
+};
+
+static void hash_function(void *arg, size_t i)
+{
+    struct icf_function *func = &((struct icf_function *) arg)[i];
+    func->hash = hash_code(func->sym->data, func->sym->size, func->sym->address, true);
+}
+
+// order by contents, then by address so that the first copy is kept
+static int compare_functions(const void *a, const void *b)
+{
+    const struct icf_function *x = a;
+    const struct icf_function *y = b;
+
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    if (x->sym->size != y->sym->size) {
+        return x->sym->size < y->sym->size ? -1 : 1;
+    }
+    return x->sym->address < y->sym->address ? -1 : x->sym->address > y->sym->address;
+}
+
+static int compare_groups(const void *a, const void *b)
+{
+    const struct icf_group *x = a;
+    const struct icf_group *y = b;
+
+    if (x->reclaimed != y->reclaimed) {
+        return x->reclaimed < y->reclaimed ? 1 : -1;
+    }
+    return x->first < y->first ? -1 : x->first > y->first;
+}
+
+void report_icf(const struct elf_symbol *syms, size_t nsyms, long jobs, FILE *out)
+{
+    struct icf_function *funcs = malloc(nsyms * sizeof(*funcs));
+    for (size_t i = 0; i < nsyms; ++i) {
+        funcs[i] = (struct icf_function) { &syms[i], 0 };
+    }
+    parallel_for(nsyms, jobs, hash_function, funcs);
+    qsort(funcs, nsyms, sizeof(*funcs), compare_functions);
+
+    struct icf_group *groups = malloc(nsyms * sizeof(*groups));
+    size_t ngroups = 0;
+    for (size_t i = 0; i < nsyms;) {
+        size_t j = i + 1;
+        while (j < nsyms && funcs[j].hash == funcs[i].hash && funcs[j].sym->size == funcs[i].sym->size) {
+            ++j;
+        }
+        if (j - i > 1) {
+            groups[ngroups++] = (struct icf_group) { i, j - i, (j - i - 1) * funcs[i].sym->size };
+        }
+        i = j;
+    }
+    qsort(groups, ngroups, sizeof(*groups), compare_groups);
+
+    uint64_t total = 0;
+    size_t folded = 0;
+    for (size_t g = 0; g < ngroups; ++g) {
+        const struct icf_group *group = &groups[g];
+        fprintf(out, "%zu identical functions of %" PRIu64 " bytes:", group->count, funcs[group->first].sym->size);
+        for (size_t i = 0; i < group->count && i < MAX_GROUP_NAMES; ++i) {
+            fprintf(out, "%s %s", i == 0 ? "" : ",", funcs[group->first + i].sym->name);
+        }
+        if (group->count > MAX_GROUP_NAMES) {
+            fprintf(out, " and %zu more", group->count - MAX_GROUP_NAMES);
+        }
+        fprintf(out, "\n");
+        total += group->reclaimed;
+        folded += group->count - 1;
+    }
+    if (total != 0) {
+        fprintf(out, "identical code folding would reclaim %" PRIu64 " bytes from %zu functions\n", total, folded);
+    }
+
+    free(groups);
+    free(funcs);
+}
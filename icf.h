@@ -0,0 +1,31 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ICF_H__
+#define __ICF_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "elffile.h"
+
+// Group functions whose instructions are identical apart from where they are
+// placed and print each group and the bytes identical code folding would
+// reclaim by keeping one copy of each.  Functions are hashed on up to jobs
+// threads.
+void report_icf(const struct elf_symbol *syms, size_t nsyms, long jobs, FILE *out);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "layout.h"
+
+#define CACHE_LINE_SIZE 64
+// an extra cache line matters less for larger loops
+#define MAX_LOOP_LINES 4
+
+struct layout_report {
+    FILE *out;
+    void (*on_finding)(void *arg, uint64_t address);
+    void *arg;
+    int errors;
+};
+
+// print a finding and an optional line of detail
+static void report(struct layout_report *r, const char *message, uint64_t address, const char *detail)
+{
+    fprintf(r->out, "%s at address: 0x%" PRIx64 "\n", message, address);
+    if (detail != NULL) {
+        fprintf(r->out, "%s\n", detail);
+    }
+    if (r->on_finding != NULL) {
+        r->on_finding(r->arg, address);
+    }
+    fprintf(r->out, "\n");
+    ++r->errors;
+}
+
+static const struct cfg_inst *first_inst(const struct cfg *cfg, size_t block)
+{
+    return block == CFG_NO_BLOCK ? NULL : &cfg->insts[cfg->blocks[block].first];
+}
+
+static void check_jumps(const struct cfg *cfg, struct layout_report *r)
+{
+    for (size_t b = 0; b < cfg->nblocks; ++b) {
+        const struct cfg_block *block = &cfg->blocks[b];
+        size_t last_index = block->first + block->count - 1;
+        const struct cfg_inst *last = &cfg->insts[last_index];
+
+        if (last->flow != CFG_FLOW_JUMP && last->flow != CFG_FLOW_BRANCH) {
+            continue;
+        }
+        // a tail call to the function laid out next is not removable
+        if (last->target == last->address + last->length && last->target < cfg->address + cfg->size) {
+            report(r, last->flow == CFG_FLOW_JUMP ? "jump to next instruction" :
+                   "conditional branch to next instruction", last->address, NULL);
+            continue;
+        }
+
+        // jumps to themselves are deliberate spins
+        const struct cfg_inst *target = first_inst(cfg, block->taken);
+        if (target != NULL && target != last && target->flow == CFG_FLOW_JUMP) {
+            char detail[64];
+            snprintf(detail, sizeof(detail), "0x%" PRIx64 " -> 0x%" PRIx64 " -> 0x%" PRIx64,
+                     last->address, target->address, target->target);
+            report(r, "jump to jump", last->address, detail);
+        } else if (target != NULL && last->flow == CFG_FLOW_JUMP && target->flow == CFG_FLOW_RETURN) {
+            report(r, "jump to RET", last->address, NULL);
+        }
+
+        // Jcc L1 ; JMP L2 ; L1: becomes J!cc L2
+        if (last->flow == CFG_FLOW_BRANCH && last_index + 1 < cfg->ninsts) {
+            const struct cfg_inst *next = &cfg->insts[last_index + 1];
+            if (next->flow == CFG_FLOW_JUMP && last->target == next->address + next->length) {
+                report(r, "conditional branch over jump", last->address, NULL);
+            }
+        }
+    }
+}
+
+// Report loops whose body would fit in fewer cache lines if the loop head
+// were aligned.
+static void check_loops(const struct cfg *cfg, struct layout_report *r)
+{
+    uint64_t *loop_end = malloc(cfg->nblocks * sizeof(*loop_end));
+    cfg_loop_ends(cfg, loop_end);
+
+    for (size_t head = 0; head < cfg->nblocks; ++head) {
+        if (loop_end[head] == 0) {
+            continue;
+        }
+        uint64_t start = cfg->blocks[head].start;
+        uint64_t size = loop_end[head] - start;
+        uint64_t lines = (loop_end[head] - 1) / CACHE_LINE_SIZE - start / CACHE_LINE_SIZE + 1;
+        uint64_t needed = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+        if (lines > needed && needed <= MAX_LOOP_LINES) {
+            char detail[96];
+            snprintf(detail, sizeof(detail), "loop of %" PRIu64 " bytes spans %" PRIu64 " cache lines instead of %"
+                     PRIu64, size, lines, needed);
+            report(r, "misaligned loop", start, detail);
+        }
+    }
+
+    free(loop_end);
+}
+
+int check_layout(const struct cfg *cfg, FILE *out, void (*on_finding)(void *arg, uint64_t address), void *arg)
+{
+    struct layout_report r = { out, on_finding, arg, 0 };
+
+    check_jumps(cfg, &r);
+    check_loops(cfg, &r);
+    return r.errors;
+}
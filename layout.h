@@ -0,0 +1,31 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LAYOUT_H__
+#define __LAYOUT_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cfg.h"
+
+// Print branch layout problems in a function: jumps to the next instruction,
+// jumps to jumps, jumps to RET, conditional branches over a jump, and small
+// loops which span more cache lines than their size requires.  Call
+// on_finding, if non-NULL, after each.  Return the number of problems.
+int check_layout(const struct cfg *cfg, FILE *out, void (*on_finding)(void *arg, uint64_t address), void *arg);
+
+#endif
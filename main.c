@@ -15,73 +15,480 @@
  */
 
 #include <elf.h>
+#include <getopt.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "cfg.h"
+#include "diff.h"
+#include "dwarf.h"
+#include "elffile.h"
+#include "forwarding.h"
+#include "icf.h"
+#include "layout.h"
+#include "padding.h"
+#include "parallel.h"
+#include "plt.h"
+#include "process.h"
+#include "throughput.h"
 #include "x86lint.h"
 
-int main(int argc, char **argv)
+// cross-check the length decoder against XED, set by --validate-decoder
+static bool validate_length;
+
+static void usage(const char *argv0)
+{
+  printf("usage: %s [--stats=json|prometheus] [--jobs=N] [--validate-decoder] [--functions] <ELF_FILE|ARCHIVE>\n",
+         argv0);
+  printf("       %s [--stats=json|prometheus] [--jobs=N] --diff <OLD_ELF_FILE> <NEW_ELF_FILE>\n", argv0);
+  printf("       %s [--stats=json|prometheus] --pid=PID [--interval=SECONDS]\n", argv0);
+  printf("         --interval clears the soft-dirty bits of the whole process, which adds write faults\n"
+         "         and disturbs other soft-dirty users such as CRIU\n");
+  printf("       %s --padding <ELF_FILE>\n", argv0);
+  printf("       %s --throughput=", argv0);
+  uarch_print_names(stdout);
+  printf(" <ELF_FILE>\n");
+  exit(1);
+}
+
+// where a region of instructions came from, printed after each finding
+struct lint_context {
+  FILE *out;
+  const struct line_index *lines;
+  // archive member or NULL
+  const char *member;
+  // section name for relocatable objects whose sections all start at zero, or NULL
+  const char *section;
+};
+
+static void print_address_location(void *arg, uint64_t address)
+{
+  const struct lint_context *ctx = arg;
+  const struct line_row *row = ctx->lines != NULL ? line_index_lookup(ctx->lines, address) : NULL;
+  const char *sep = "";
+
+  if (ctx->member != NULL) {
+    fprintf(ctx->out, "%s", ctx->member);
+    sep = " ";
+  }
+  if (ctx->section != NULL) {
+    fprintf(ctx->out, "%s%s", sep, ctx->section);
+    sep = " ";
+  }
+  if (row != NULL) {
+    fprintf(ctx->out, "%s%s:%u", sep, ctx->lines->files[row->file], row->line);
+  }
+  fprintf(ctx->out, "\n");
+}
+
+static void print_location(void *arg, enum x86lint_rule rule, uint64_t address)
+{
+  print_address_location(arg, address);
+}
+
+static int lint_region(struct lint_context *ctx, const char *name, const uint8_t *data, uint64_t size,
+                       uint64_t address, const uint64_t *relocations, size_t nrelocations)
+{
+  struct x86lint_options options = {
+    .address = address,
+    .out = ctx->out,
+    .on_finding = ctx->lines != NULL || ctx->member != NULL || ctx->section != NULL ? print_location : NULL,
+    .arg = ctx,
+    .relocations = relocations,
+    .nrelocations = nrelocations,
+    .validate_length = validate_length,
+  };
+
+  if (data == NULL) {
+    fprintf(stderr, "%s is out of bounds\n", name);
+    return 0;
+  }
+  int errors = check_instructions_with(data, size, &options);
+  if (errors < 0) {
+    fprintf(ctx->out, "skipping remainder of %s\n", name);
+    return 0;
+  }
+  return errors;
+}
+
+// lint every executable section, or every executable segment if the file has no section headers
+static int lint_elf(struct lint_context *ctx, const struct elf_file *elf)
 {
-  FILE* ElfFile = NULL;
-  char* SectNames = NULL;
-  Elf64_Ehdr elfHdr;
-  Elf64_Shdr sectHdr;
-  uint32_t idx;
   int errors = 0;
+  bool found = false;
+  bool relocatable = elf->ehdr->e_type == ET_REL;
 
-  if(argc != 2) {
-    printf("usage: %s <ELF_FILE>\n", argv[0]);
-    exit(1);
+  for (size_t idx = 0; idx < elf->shnum; idx++) {
+    const Elf64_Shdr *shdr = &elf->shdrs[idx];
+    if (shdr->sh_type != SHT_PROGBITS || (shdr->sh_flags & SHF_EXECINSTR) == 0 || shdr->sh_size == 0) {
+      continue;
+    }
+    found = true;
+
+    const char *name = elf_section_name(elf, shdr);
+    uint64_t *relocations = NULL;
+    size_t nrelocations = 0;
+    if (relocatable) {
+      relocations = elf_section_relocations(elf, shdr, &nrelocations);
+      ctx->section = name;
+    }
+    errors += lint_region(ctx, name, elf_section_data(elf, shdr), shdr->sh_size, shdr->sh_addr,
+                          relocations, nrelocations);
+    ctx->section = NULL;
+    free(relocations);
   }
 
-  if((ElfFile = fopen(argv[1], "r")) == NULL) {
-    perror("Error opening file");
-    exit(1);
+  if (found) {
+    return errors;
   }
 
-  xed_tables_init();
-  xed_set_verbosity(99);
+  for (size_t idx = 0; idx < elf->phnum; idx++) {
+    const Elf64_Phdr *phdr = &elf->phdrs[idx];
+    if (phdr->p_type != PT_LOAD || (phdr->p_flags & PF_X) == 0 || phdr->p_filesz == 0) {
+      continue;
+    }
+    errors += lint_region(ctx, "PT_LOAD segment", elf_segment_data(elf, phdr), phdr->p_filesz,
+                          phdr->p_vaddr, NULL, 0);
+  }
+
+  return errors;
+}
 
-  // read ELF header, first thing in the file
-  fread(&elfHdr, 1, sizeof(Elf64_Ehdr), ElfFile);
+// function checked by a worker thread into its own output buffer
+struct function_job {
+  const struct elf_symbol *sym;
+  const struct lint_context *ctx;
+  // NULL if the binary has no named GOT slots
+  const struct plt_calls *calls;
+  char *output;
+  size_t output_size;
+  int errors;
+  size_t saved;
+  struct plt_site *sites;
+  size_t nsites;
+};
 
-  fseek(ElfFile, elfHdr.e_shoff + elfHdr.e_shstrndx * sizeof(sectHdr), SEEK_SET);
-  fread(&sectHdr, 1, sizeof(sectHdr), ElfFile);
+static void check_function(void *arg, size_t idx)
+{
+  struct function_job *job = &((struct function_job *) arg)[idx];
+  const struct elf_symbol *sym = job->sym;
+  struct lint_context ctx = *job->ctx;
+  struct cfg cfg;
 
-  // next, read the section, string data
-  SectNames = malloc(sectHdr.sh_size);
-  fseek(ElfFile, sectHdr.sh_offset, SEEK_SET);
-  fread(SectNames, 1, sectHdr.sh_size, ElfFile);
+  ctx.out = open_memstream(&job->output, &job->output_size);
 
-  // read all section headers
-  for (idx = 0; idx < elfHdr.e_shnum; idx++) {
-    const char* name = "";
+  cfg_build(&cfg, sym->data, sym->size, sym->address);
+  void (*on_finding)(void *, uint64_t) = ctx.lines != NULL ? print_address_location : NULL;
+  job->errors = check_layout(&cfg, ctx.out, on_finding, &ctx);
+  job->errors += check_forwarding(&cfg, ctx.out, on_finding, &ctx);
+  if (job->calls != NULL) {
+    job->nsites = plt_find_calls(job->calls, &cfg, &job->sites);
+  }
+  cfg_free(&cfg);
 
-    fseek(ElfFile, elfHdr.e_shoff + idx * sizeof(sectHdr), SEEK_SET);
-    fread(&sectHdr, 1, sizeof(sectHdr), ElfFile);
+  job->saved = relax_branches(sym->data, sym->size);
+  if (job->saved != 0) {
+    fprintf(ctx.out, "relaxing branches in %s would save %zu bytes\n", sym->name, job->saved);
+  }
+  fclose(ctx.out);
+}
 
-    if (!sectHdr.sh_name) {
-      continue;
+// Check branch layout and memory accesses in each function in parallel, then
+// report the bytes re-encoding branches with minimal displacements and folding
+// identical functions would save, and calls through the PLT and GOT.  Return
+// the number of layout and memory problems; the reports are not findings.
+static int check_functions(struct lint_context *ctx, const struct elf_file *elf, long jobs)
+{
+  struct elf_symbol *syms;
+  ssize_t nsyms = elf_functions(elf, &syms);
+  size_t total = 0;
+  size_t nfuncs = 0;
+  int errors = 0;
+  struct plt_calls calls;
+
+  if (nsyms < 0) {
+    return 0;
+  }
+  // static binaries have no named GOT slots
+  bool dynamic = plt_init(&calls, elf) == 0;
+
+  struct function_job *function_jobs = calloc(nsyms, sizeof(*function_jobs));
+  for (ssize_t i = 0; i < nsyms; ++i) {
+    function_jobs[i].sym = &syms[i];
+    function_jobs[i].ctx = ctx;
+    function_jobs[i].calls = dynamic ? &calls : NULL;
+  }
+
+  parallel_for(nsyms, jobs, check_function, function_jobs);
+
+  for (ssize_t i = 0; i < nsyms; ++i) {
+    struct function_job *job = &function_jobs[i];
+    fwrite(job->output, 1, job->output_size, ctx->out);
+    free(job->output);
+    errors += job->errors;
+    if (job->saved != 0) {
+      total += job->saved;
+      ++nfuncs;
+    }
+    if (dynamic) {
+      plt_count_calls(&calls, job->sites, job->nsites, syms[i].name);
     }
-    name = SectNames + sectHdr.sh_name;
+    free(job->sites);
+  }
+  if (total != 0) {
+    fprintf(ctx->out, "relaxing branches would save %zu bytes in %zu functions\n", total, nfuncs);
+  }
+  report_icf(syms, nsyms, jobs, ctx->out);
+  if (dynamic) {
+    plt_report(&calls, ctx->out);
+    plt_free(&calls);
+  }
+  free(function_jobs);
+  free(syms);
+  return errors;
+}
 
-    // TODO: look at p_flags & PF_X instead?
-    if (strcmp(name, ".text") != 0) {
-      continue;
+// archive member linted by a worker thread into its own output buffer
+struct member_job {
+  const struct ar_member *member;
+  char *output;
+  size_t output_size;
+  int errors;
+};
+
+static void lint_member(void *arg, size_t idx)
+{
+  struct member_job *job = &((struct member_job *) arg)[idx];
+  const struct ar_member *member = job->member;
+  struct lint_context ctx = { NULL, NULL, member->name, NULL };
+  struct elf_file elf;
+  uint8_t *copy = NULL;
+  const uint8_t *data = member->data;
+
+  ctx.out = open_memstream(&job->output, &job->output_size);
+
+  // archive members are only two-byte aligned
+  if ((uintptr_t) data % 8 != 0) {
+    copy = malloc(member->size);
+    memcpy(copy, data, member->size);
+    data = copy;
+  }
+
+  X86LINT_STATS_START(parse_start);
+  if (elf_init(&elf, data, member->size) == 0) {
+    X86LINT_STATS_ELAPSED(parse_ticks, parse_start);
+    job->errors = lint_elf(&ctx, &elf);
+  } else {
+    fprintf(ctx.out, "skipping %s\n", member->name);
+  }
+
+  fclose(ctx.out);
+  free(copy);
+}
+
+// lint archive members in parallel and print their findings in archive order
+static int lint_archive(const uint8_t *data, size_t size, long jobs)
+{
+  struct ar_member *members;
+  ssize_t nmembers = ar_members(data, size, &members);
+  int errors = 0;
+
+  if (nmembers < 0) {
+    return -1;
+  }
+
+  struct member_job *member_jobs = calloc(nmembers, sizeof(*member_jobs));
+  for (ssize_t i = 0; i < nmembers; ++i) {
+    member_jobs[i].member = &members[i];
+  }
+
+  parallel_for(nmembers, jobs, lint_member, member_jobs);
+
+  for (ssize_t i = 0; i < nmembers; ++i) {
+    struct member_job *job = &member_jobs[i];
+    fwrite(job->output, 1, job->output_size, stdout);
+    free(job->output);
+    errors += job->errors;
+  }
+
+  free(member_jobs);
+  ar_free(members, nmembers);
+  return errors;
+}
+
+// Lint an ELF file or archive, and check each function of a linked binary if
+// functions is set.  Return -1 on error or the number of findings.
+static int lint_file(const char *path, long jobs, bool functions)
+{
+  const uint8_t *data;
+  size_t size;
+  int errors;
+
+  if (map_file(path, &data, &size) == -1) {
+    return -1;
+  }
+
+  if (ar_is_archive(data, size)) {
+    errors = lint_archive(data, size, jobs);
+  } else {
+    struct elf_file elf;
+    struct line_index lines;
+    bool have_lines = false;
+
+    X86LINT_STATS_START(parse_start);
+    if (elf_init(&elf, data, size) == -1) {
+      unmap_file(data, size);
+      return -1;
     }
+    // line tables in relocatable objects need relocations applied first
+    if (elf.ehdr->e_type != ET_REL) {
+      have_lines = line_index_build(&lines, &elf) == 0;
+    }
+    X86LINT_STATS_ELAPSED(parse_ticks, parse_start);
 
-    char *buf = malloc(sectHdr.sh_size);
-    fseek(ElfFile, sectHdr.sh_offset, SEEK_SET);
-    fread(buf, 1, sectHdr.sh_size, ElfFile);
-    errors += check_instructions((uint8_t *)buf, sectHdr.sh_size);
-    free(buf);
+    struct lint_context ctx = { stdout, have_lines ? &lines : NULL, NULL, NULL };
+    errors = lint_elf(&ctx, &elf);
+    // branch displacements in relocatable objects are not final
+    if (functions && elf.ehdr->e_type != ET_REL) {
+      errors += check_functions(&ctx, &elf, jobs);
+    }
+    if (have_lines) {
+      line_index_free(&lines);
+    }
   }
 
-  printf("%d errors\n", errors);
+  if (errors >= 0) {
+    printf("%d errors\n", errors);
+  }
+  unmap_file(data, size);
+  return errors;
+}
+
+int main(int argc, char **argv)
+{
+  int errors = 0;
+  const char *stats = NULL;
+  bool diff = false;
+  bool functions = false;
+  bool padding = false;
+  const struct uarch *uarch = NULL;
+  pid_t pid = 0;
+  long interval = 0;
+  long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+  static const struct option options[] = {
+    { "diff", no_argument, NULL, 'd' },
+    { "functions", no_argument, NULL, 'f' },
+    { "interval", required_argument, NULL, 'i' },
+    { "jobs", required_argument, NULL, 'j' },
+    { "padding", no_argument, NULL, 'P' },
+    { "pid", required_argument, NULL, 'p' },
+    { "stats", required_argument, NULL, 's' },
+    { "throughput", required_argument, NULL, 't' },
+    { "validate-decoder", no_argument, NULL, 'v' },
+    { NULL, 0, NULL, 0 },
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "j:", options, NULL)) != -1) {
+    switch (opt) {
+    case 'd':
+      diff = true;
+      break;
+    case 'f':
+      functions = true;
+      break;
+    case 'i':
+      interval = strtol(optarg, NULL, 10);
+      if (interval < 1) {
+        usage(argv[0]);
+      }
+      break;
+    case 'j':
+      jobs = strtol(optarg, NULL, 10);
+      if (jobs < 1) {
+        usage(argv[0]);
+      }
+      break;
+    case 'P':
+      padding = true;
+      break;
+    case 'p':
+      pid = strtol(optarg, NULL, 10);
+      if (pid < 1) {
+        usage(argv[0]);
+      }
+      break;
+    case 's':
+      stats = optarg;
+      break;
+    case 't':
+      uarch = uarch_find(optarg);
+      if (uarch == NULL) {
+        usage(argv[0]);
+      }
+      break;
+    case 'v':
+      validate_length = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  int nfiles = diff ? 2 : pid != 0 ? 0 : 1;
+  if (diff + padding + (pid != 0) + (uarch != NULL) > 1 || optind + nfiles != argc) {
+    usage(argv[0]);
+  }
+  if (interval != 0 && pid == 0) {
+    usage(argv[0]);
+  }
+  if (functions && (diff || padding || pid != 0 || uarch != NULL)) {
+    usage(argv[0]);
+  }
+
+#ifdef X86LINT_STATS
+  enum x86lint_stats_format stats_format = X86LINT_STATS_JSON;
+  if (stats == NULL || strcmp(stats, "json") == 0) {
+    stats_format = X86LINT_STATS_JSON;
+  } else if (strcmp(stats, "prometheus") == 0) {
+    stats_format = X86LINT_STATS_PROMETHEUS;
+  } else {
+    usage(argv[0]);
+  }
+  x86lint_stats_reset();
+#else
+  if (stats != NULL) {
+    fprintf(stderr, "--stats requires building with X86LINT_STATS=1\n");
+    exit(1);
+  }
+#endif
+
+  xed_tables_init();
+  xed_set_verbosity(99);
+
+  if (padding) {
+    errors = padding_report(argv[optind]);
+  } else if (uarch != NULL) {
+    errors = throughput_report(argv[optind], uarch);
+  } else if (pid != 0) {
+    errors = lint_process(pid, interval);
+  } else if (diff) {
+    errors = diff_files(argv[optind], argv[optind + 1], jobs);
+  } else {
+    errors = lint_file(argv[optind], jobs, functions);
+  }
+  if (errors < 0) {
+    exit(1);
+  }
+
+#ifdef X86LINT_STATS
+  if (stats != NULL) {
+    x86lint_stats_print(stderr, stats_format);
+  }
+#endif
 
   return (bool) errors;
 }
-
@@ -0,0 +1,398 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "dwarf.h"
+#include "elffile.h"
+#include "padding.h"
+
+#define CACHE_LINE_SIZE 64
+#define MAX_UNKNOWN_LOOP_SIZE 4096
+
+static const char *const padding_kind_names[PADDING_KIND_COUNT] = {
+    "function alignment",
+    "loop alignment",
+    "other",
+};
+
+struct branch {
+    uint64_t source;
+    uint64_t target;
+};
+
+struct section_scan {
+    struct padding_run *runs;
+    size_t nruns;
+    size_t runs_capacity;
+    // backward jumps, which close loops
+    struct branch *loops;
+    size_t nloops;
+    size_t loops_capacity;
+};
+
+bool is_nop(const struct x86_length *fast)
+{
+    if (fast->encoding != X86_ENCODING_LEGACY) {
+        return false;
+    }
+    // 90 without REX.B is XCHG EAX, EAX; F3 90 is PAUSE
+    if (fast->map == 0 && fast->opcode == 0x90) {
+        return (fast->rex & 0x01) == 0 && !fast->rep;
+    }
+    // 0F 1F /0 is the multi-byte NOP
+    return fast->map == 1 && fast->opcode == 0x1f && (fast->modrm & 0x38) == 0;
+}
+
+// return true if control cannot continue to the next instruction
+static bool is_unconditional(const struct x86_length *fast)
+{
+    enum cfg_flow flow = cfg_flow(fast);
+    return flow == CFG_FLOW_JUMP || flow == CFG_FLOW_INDIRECT || flow == CFG_FLOW_RETURN || flow == CFG_FLOW_STOP;
+}
+
+static int64_t branch_displacement(const uint8_t *inst, const struct x86_length *fast)
+{
+    const uint8_t *imm = inst + fast->length - fast->imm_size;
+    if (fast->imm_size == 1) {
+        return (int8_t) imm[0];
+    }
+    int32_t disp;
+    memcpy(&disp, imm, sizeof(disp));
+    return disp;
+}
+
+static void add_run(struct section_scan *scan, uint64_t start, uint64_t end, bool has_int3, bool fall_through)
+{
+    if (scan->nruns == scan->runs_capacity) {
+        scan->runs_capacity = scan->runs_capacity == 0 ? 1024 : scan->runs_capacity * 2;
+        scan->runs = realloc(scan->runs, scan->runs_capacity * sizeof(*scan->runs));
+    }
+    scan->runs[scan->nruns++] = (struct padding_run) { start, end, PADDING_OTHER, has_int3, fall_through, false };
+}
+
+static void add_loop(struct section_scan *scan, uint64_t source, uint64_t target)
+{
+    if (scan->nloops == scan->loops_capacity) {
+        scan->loops_capacity = scan->loops_capacity == 0 ? 1024 : scan->loops_capacity * 2;
+        scan->loops = realloc(scan->loops, scan->loops_capacity * sizeof(*scan->loops));
+    }
+    scan->loops[scan->nloops++] = (struct branch) { source, target };
+}
+
+// Walk a section once, recording padding runs and backward jumps.  Bytes
+// which do not decode are stepped over one at a time.
+static void scan_section(struct section_scan *scan, const uint8_t *data, uint64_t size, uint64_t address)
+{
+    uint64_t run_start = 0;
+    bool in_run = false;
+    bool run_has_int3 = false;
+    bool run_fall_through = false;
+    bool falls_through = false;
+
+    for (uint64_t offset = 0; offset < size;) {
+        struct x86_length fast;
+        size_t len = x86_length_decode(data + offset, size - offset, &fast);
+        bool decoded = len != 0;
+        bool padding = false;
+        bool int3 = false;
+
+        if (decoded) {
+            int3 = fast.map == 0 && fast.opcode == 0xcc && fast.encoding == X86_ENCODING_LEGACY;
+            padding = is_nop(&fast) || int3;
+        } else {
+            len = cfg_xed_length(data + offset, size - offset);
+        }
+
+        if (padding && !in_run) {
+            in_run = true;
+            run_start = address + offset;
+            run_has_int3 = false;
+            run_fall_through = falls_through;
+        } else if (!padding && in_run) {
+            add_run(scan, run_start, address + offset, run_has_int3, run_fall_through);
+            in_run = false;
+        }
+
+        if (len == 0) {
+            falls_through = false;
+            ++offset;
+            continue;
+        }
+
+        run_has_int3 |= int3;
+        if (decoded && fast.relative_branch) {
+            bool call = fast.map == 0 && fast.opcode == 0xe8;
+            uint64_t source = address + offset;
+            uint64_t target = source + len + branch_displacement(data + offset, &fast);
+            if (!call && target <= source) {
+                add_loop(scan, source, target);
+            }
+        }
+        // padding continues the fall-through state of what precedes it
+        if (!padding) {
+            falls_through = !decoded || !is_unconditional(&fast);
+        }
+        offset += len;
+    }
+
+    if (in_run) {
+        add_run(scan, run_start, address + size, run_has_int3, run_fall_through);
+    }
+}
+
+static int compare_loop_target(const void *a, const void *b)
+{
+    const struct branch *x = a;
+    const struct branch *y = b;
+    return x->target < y->target ? -1 : x->target > y->target;
+}
+
+// return the first loop whose head is at or after address
+static size_t lower_bound_loop(const struct branch *loops, size_t nloops, uint64_t address)
+{
+    size_t lo = 0;
+    size_t hi = nloops;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (loops[mid].target < address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// return the first run starting at or after address
+static size_t lower_bound_run(const struct padding_run *runs, size_t nruns, uint64_t address)
+{
+    size_t lo = 0;
+    size_t hi = nruns;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (runs[mid].start < address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bool function_starts_at(const struct elf_symbol *syms, size_t nsyms, uint64_t address)
+{
+    const struct elf_symbol *sym = elf_function_at(syms, nsyms, address);
+    return sym != NULL && sym->address == address;
+}
+
+// Classify runs by what they align and mark fall-through runs inside loops.
+// INT3 runs which do not precede a function are traps rather than padding.
+static void classify_runs(struct section_scan *scan, const struct elf_symbol *syms, size_t nsyms)
+{
+    // Backward tail calls are not loops.  Without a symbol, assume that
+    // short jumps stay within one function.
+    size_t nloops = 0;
+    for (size_t i = 0; i < scan->nloops; ++i) {
+        const struct branch *loop = &scan->loops[i];
+        const struct elf_symbol *sym = elf_function_at(syms, nsyms, loop->source);
+        if (sym != NULL ? loop->target >= sym->address : loop->source - loop->target < MAX_UNKNOWN_LOOP_SIZE) {
+            scan->loops[nloops++] = *loop;
+        }
+    }
+    scan->nloops = nloops;
+
+    qsort(scan->loops, scan->nloops, sizeof(*scan->loops), compare_loop_target);
+
+    for (size_t i = 0; i < scan->nloops; ++i) {
+        const struct branch *loop = &scan->loops[i];
+        for (size_t j = lower_bound_run(scan->runs, scan->nruns, loop->target);
+             j < scan->nruns && scan->runs[j].start < loop->source; ++j) {
+            scan->runs[j].hot |= scan->runs[j].fall_through;
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < scan->nruns; ++i) {
+        struct padding_run *run = &scan->runs[i];
+        size_t loop = lower_bound_loop(scan->loops, scan->nloops, run->end);
+        if (function_starts_at(syms, nsyms, run->end)) {
+            run->kind = PADDING_FUNCTION;
+        } else if (loop < scan->nloops && scan->loops[loop].target == run->end) {
+            run->kind = PADDING_LOOP;
+        } else if (run->has_int3) {
+            continue;
+        }
+        scan->runs[kept++] = *run;
+    }
+    scan->nruns = kept;
+}
+
+size_t padding_find_runs(const uint8_t *data, size_t size, uint64_t address, const struct elf_symbol *syms,
+                         size_t nsyms, struct padding_run **runs)
+{
+    struct section_scan scan = { 0 };
+    scan_section(&scan, data, size, address);
+    classify_runs(&scan, syms, nsyms);
+    free(scan.loops);
+    *runs = scan.runs;
+    return scan.nruns;
+}
+
+void padding_add_stats(struct padding_stats *stats, const struct padding_run *run)
+{
+    uint64_t first_full = (run->start + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE;
+    uint64_t end_full = run->end / CACHE_LINE_SIZE;
+
+    stats->bytes += run->end - run->start;
+    stats->runs += 1;
+    stats->lines += (run->end - 1) / CACHE_LINE_SIZE - run->start / CACHE_LINE_SIZE + 1;
+    stats->full_lines += end_full > first_full ? end_full - first_full : 0;
+}
+
+static void print_stats(const char *name, const struct padding_stats *stats)
+{
+    printf("%s: %" PRIu64 " bytes in %" PRIu64 " runs over %" PRIu64 " cache lines, %"
+           PRIu64 " lines entirely padding\n",
+           name, stats->bytes, stats->runs, stats->lines, stats->full_lines);
+}
+
+static void print_location(const struct line_index *lines, uint64_t address)
+{
+    const struct line_row *row = lines != NULL ? line_index_lookup(lines, address) : NULL;
+    if (row != NULL) {
+        printf(" %s:%u", lines->files[row->file], row->line);
+    }
+}
+
+// padding attributed to one function
+struct function_padding {
+    const struct elf_symbol *sym;
+    struct padding_stats stats;
+};
+
+static int compare_function_bytes(const void *a, const void *b)
+{
+    const struct function_padding *x = a;
+    const struct function_padding *y = b;
+    if (x->stats.bytes != y->stats.bytes) {
+        return x->stats.bytes > y->stats.bytes ? -1 : 1;
+    }
+    return x->sym->address < y->sym->address ? -1 : x->sym->address > y->sym->address;
+}
+
+int padding_report(const char *path)
+{
+    struct elf_file elf;
+    struct elf_symbol *syms = NULL;
+    struct line_index lines;
+    struct padding_stats total = { 0 };
+    struct padding_stats kinds[PADDING_KIND_COUNT] = { { 0 } };
+    struct padding_stats fall_through = { 0 };
+    struct padding_stats hot = { 0 };
+
+    if (elf_open(&elf, path) == -1) {
+        return -1;
+    }
+    if (elf.ehdr->e_type == ET_REL) {
+        fprintf(stderr, "%s: padding between functions is only known after linking\n", path);
+        elf_close(&elf);
+        return -1;
+    }
+    ssize_t nsyms = elf_functions(&elf, &syms);
+    if (nsyms < 0) {
+        nsyms = 0;
+    }
+    bool have_lines = line_index_build(&lines, &elf) == 0;
+    struct function_padding *funcs = calloc(nsyms + 1, sizeof(*funcs));
+    for (ssize_t i = 0; i < nsyms; ++i) {
+        funcs[i].sym = &syms[i];
+    }
+
+    printf("hot fall-through padding:\n");
+    for (size_t idx = 0; idx < elf.shnum; idx++) {
+        const Elf64_Shdr *shdr = &elf.shdrs[idx];
+        if (shdr->sh_type != SHT_PROGBITS || (shdr->sh_flags & SHF_EXECINSTR) == 0 || shdr->sh_size == 0) {
+            continue;
+        }
+        const uint8_t *data = elf_section_data(&elf, shdr);
+        if (data == NULL) {
+            fprintf(stderr, "%s is out of bounds\n", elf_section_name(&elf, shdr));
+            continue;
+        }
+
+        struct padding_run *runs;
+        size_t nruns = padding_find_runs(data, shdr->sh_size, shdr->sh_addr, syms, nsyms, &runs);
+        for (size_t i = 0; i < nruns; ++i) {
+            const struct padding_run *run = &runs[i];
+            // function alignment belongs to the function it aligns
+            const struct elf_symbol *sym = elf_function_at(syms, nsyms, run->start);
+            if (run->kind == PADDING_FUNCTION || sym == NULL) {
+                sym = elf_function_at(syms, nsyms, run->end);
+            }
+
+            padding_add_stats(&total, run);
+            padding_add_stats(&kinds[run->kind], run);
+            if (sym != NULL) {
+                padding_add_stats(&funcs[sym - syms].stats, run);
+            }
+            if (run->fall_through) {
+                padding_add_stats(&fall_through, run);
+            }
+            if (run->hot) {
+                padding_add_stats(&hot, run);
+                printf("0x%" PRIx64 ": %" PRIu64 " bytes of %s", run->start, run->end - run->start,
+                       padding_kind_names[run->kind]);
+                if (sym != NULL) {
+                    printf(" in %s", sym->name);
+                }
+                print_location(have_lines ? &lines : NULL, run->start);
+                printf("\n");
+            }
+        }
+
+        free(runs);
+    }
+
+    printf("\n");
+    print_stats("padding", &total);
+    for (int kind = 0; kind < PADDING_KIND_COUNT; ++kind) {
+        print_stats(padding_kind_names[kind], &kinds[kind]);
+    }
+    print_stats("fall-through", &fall_through);
+    print_stats("hot fall-through", &hot);
+
+    qsort(funcs, nsyms, sizeof(*funcs), compare_function_bytes);
+    printf("\n%8s %6s %6s  %s\n", "bytes", "runs", "lines", "function");
+    for (ssize_t i = 0; i < nsyms && funcs[i].stats.bytes != 0; ++i) {
+        printf("%8" PRIu64 " %6" PRIu64 " %6" PRIu64 "  %s\n", funcs[i].stats.bytes, funcs[i].stats.runs,
+               funcs[i].stats.lines, funcs[i].sym->name);
+    }
+
+    free(funcs);
+    if (have_lines) {
+        line_index_free(&lines);
+    }
+    free(syms);
+    elf_close(&elf);
+    return 0;
+}
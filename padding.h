@@ -0,0 +1,74 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PADDING_H__
+#define __PADDING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "elffile.h"
+#include "x86len.h"
+
+enum padding_kind {
+    PADDING_FUNCTION,
+    PADDING_LOOP,
+    PADDING_OTHER,
+    PADDING_KIND_COUNT,
+};
+
+// consecutive NOPs, or INT3s between functions
+struct padding_run {
+    uint64_t start;
+    uint64_t end;
+    enum padding_kind kind;
+    bool has_int3;
+    // the preceding instruction can fall through into the run
+    bool fall_through;
+    // the run is inside a loop; set only for fall-through runs
+    bool hot;
+};
+
+struct padding_stats {
+    uint64_t bytes;
+    uint64_t runs;
+    uint64_t lines;
+    // 64-byte lines which contain nothing but padding
+    uint64_t full_lines;
+};
+
+// return true if the instruction is a NOP, including 10-15 byte forms which
+// repeat operand size and segment prefixes
+bool is_nop(const struct x86_length *fast);
+
+// Find the padding runs in a section of linked code at address and classify
+// them by what they align.  A run aligns a loop if it ends at the target of a
+// backward jump.  INT3 runs which do not precede a function are traps and are
+// dropped.  Return the number of runs; the caller frees the array.
+size_t padding_find_runs(const uint8_t *data, size_t size, uint64_t address, const struct elf_symbol *syms,
+                         size_t nsyms, struct padding_run **runs);
+
+// add the bytes of a run and the cache lines it touches and fills to stats
+void padding_add_stats(struct padding_stats *stats, const struct padding_run *run);
+
+// Print how many bytes and cache lines NOP padding occupies in a linked
+// binary, classified as function alignment, loop alignment or other, in
+// total and per function.  Also list padding which executes when control
+// falls through it inside a loop.  Return -1 on error, otherwise zero.
+int padding_report(const char *path);
+
+#endif
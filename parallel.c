@@ -0,0 +1,79 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "parallel.h"
+#include "x86lint.h"
+
+struct worker {
+    pthread_t thread;
+    size_t n;
+    void (*fn)(void *arg, size_t i);
+    void *arg;
+    atomic_size_t *next;
+#ifdef X86LINT_STATS
+    struct x86lint_stats stats;
+#endif
+};
+
+static void *run_worker(void *arg)
+{
+    struct worker *worker = arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(worker->next, 1)) < worker->n) {
+        worker->fn(worker->arg, i);
+    }
+#ifdef X86LINT_STATS
+    worker->stats = x86lint_stats;
+#endif
+    return NULL;
+}
+
+void parallel_for(size_t n, long jobs, void (*fn)(void *arg, size_t i), void *arg)
+{
+    atomic_size_t next = 0;
+
+    if (jobs > (long) n) {
+        jobs = n;
+    }
+    if (jobs <= 1) {
+        for (size_t i = 0; i < n; ++i) {
+            fn(arg, i);
+        }
+        return;
+    }
+
+    struct worker *workers = calloc(jobs, sizeof(*workers));
+    for (long i = 0; i < jobs; ++i) {
+        workers[i] = (struct worker) { .n = n, .fn = fn, .arg = arg, .next = &next };
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+    for (long i = 0; i < jobs; ++i) {
+        pthread_join(workers[i].thread, NULL);
+#ifdef X86LINT_STATS
+        x86lint_stats_merge(&workers[i].stats);
+#endif
+    }
+    free(workers);
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <stddef.h>
+
+// Call fn(arg, i) for each i in [0, n) on up to jobs threads.  Stats counters
+// collected by the workers are merged into the calling thread.
+void parallel_for(size_t n, long jobs, void (*fn)(void *arg, size_t i), void *arg);
+
+#endif
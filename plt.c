@@ -0,0 +1,375 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "plt.h"
+#include "x86len.h"
+
+// callees and calling functions printed
+#define MAX_LISTED 20
+// stub size when a PLT section does not record one
+#define DEFAULT_PLT_ENTRY_SIZE 16
+
+// a GOT slot and the symbol bound into it
+struct named_slot {
+    uint64_t got;
+    const char *name;
+    bool defined;
+};
+
+static int compare_names(const void *a, const void *b)
+{
+    const struct named_slot *x = a;
+    const struct named_slot *y = b;
+
+    return strcmp(x->name, y->name);
+}
+
+static int compare_slots(const void *a, const void *b)
+{
+    const struct plt_slot *x = a;
+    const struct plt_slot *y = b;
+
+    return x->got < y->got ? -1 : x->got > y->got;
+}
+
+static int compare_stubs(const void *a, const void *b)
+{
+    const struct plt_stub *x = a;
+    const struct plt_stub *y = b;
+
+    return x->address < y->address ? -1 : x->address > y->address;
+}
+
+// append the GOT slots which a relocation section against .dynsym names
+static void add_named_slots(const struct elf_file *elf, const Elf64_Shdr *rela, struct named_slot **slots,
+                            size_t *count)
+{
+    if (rela->sh_type != SHT_RELA || rela->sh_link >= elf->shnum) {
+        return;
+    }
+    const Elf64_Shdr *dynsym = &elf->shdrs[rela->sh_link];
+    if (dynsym->sh_type != SHT_DYNSYM || dynsym->sh_link >= elf->shnum) {
+        return;
+    }
+    const Elf64_Shdr *strtab = &elf->shdrs[dynsym->sh_link];
+    const Elf64_Rela *relas = (const Elf64_Rela *) elf_section_data(elf, rela);
+    const Elf64_Sym *syms = (const Elf64_Sym *) elf_section_data(elf, dynsym);
+    const char *names = (const char *) elf_section_data(elf, strtab);
+    if (relas == NULL || syms == NULL || names == NULL) {
+        return;
+    }
+
+    size_t nrelas = rela->sh_size / sizeof(Elf64_Rela);
+    size_t nsyms = dynsym->sh_size / sizeof(Elf64_Sym);
+    *slots = realloc(*slots, (*count + nrelas) * sizeof(**slots));
+    for (size_t i = 0; i < nrelas; ++i) {
+        uint32_t type = ELF64_R_TYPE(relas[i].r_info);
+        size_t index = ELF64_R_SYM(relas[i].r_info);
+        // IRELATIVE and RELATIVE slots have no symbol
+        if ((type != R_X86_64_JUMP_SLOT && type != R_X86_64_GLOB_DAT) || index == 0 || index >= nsyms) {
+            continue;
+        }
+        const Elf64_Sym *sym = &syms[index];
+        if (sym->st_name >= strtab->sh_size ||
+            memchr(names + sym->st_name, '\0', strtab->sh_size - sym->st_name) == NULL) {
+            continue;
+        }
+        (*slots)[(*count)++] = (struct named_slot) {
+            relas[i].r_offset, names + sym->st_name, sym->st_shndx != SHN_UNDEF,
+        };
+    }
+}
+
+static size_t slot_callee(const struct plt_calls *calls, uint64_t got)
+{
+    struct plt_slot key = { got, 0 };
+    const struct plt_slot *slot = bsearch(&key, calls->slots, calls->nslots, sizeof(key), compare_slots);
+    return slot == NULL ? SIZE_MAX : slot->callee;
+}
+
+static size_t stub_callee(const struct plt_calls *calls, uint64_t address)
+{
+    struct plt_stub key = { address, 0 };
+    const struct plt_stub *stub = bsearch(&key, calls->stubs, calls->nstubs, sizeof(key), compare_stubs);
+    return stub == NULL ? SIZE_MAX : stub->callee;
+}
+
+// return the GOT slot a CALL or JMP [RIP+disp] reads, or zero for other instructions
+static uint64_t got_operand(const uint8_t *inst, const struct x86_length *fast, uint64_t address)
+{
+    int reg = (fast->modrm >> 3) & 7;
+    if (fast->encoding != X86_ENCODING_LEGACY || fast->map != 0 || fast->opcode != 0xff ||
+        !fast->rip_relative || (reg != 2 && reg != 4)) {
+        return 0;
+    }
+    int32_t disp;
+    memcpy(&disp, inst + fast->length - fast->imm_size - fast->disp_size, sizeof(disp));
+    return address + fast->length + disp;
+}
+
+// Each stub jumps through its GOT slot; lazy binding stubs then push the
+// relocation index and jump to the resolver.
+static void add_stubs(struct plt_calls *calls, const struct elf_file *elf, const char *name)
+{
+    const Elf64_Shdr *shdr = elf_find_section(elf, name);
+    if (shdr == NULL) {
+        return;
+    }
+    const uint8_t *data = elf_section_data(elf, shdr);
+    if (data == NULL) {
+        return;
+    }
+    uint64_t entry_size = shdr->sh_entsize != 0 ? shdr->sh_entsize : DEFAULT_PLT_ENTRY_SIZE;
+
+    for (uint64_t offset = 0; offset < shdr->sh_size;) {
+        struct x86_length fast;
+        size_t length = x86_length_decode(data + offset, shdr->sh_size - offset, &fast);
+        if (length == 0) {
+            offset += entry_size - offset % entry_size;
+            continue;
+        }
+        uint64_t got = got_operand(data + offset, &fast, shdr->sh_addr + offset);
+        size_t callee = got != 0 ? slot_callee(calls, got) : SIZE_MAX;
+        // PLT0 jumps through a slot which holds the resolver
+        if (callee != SIZE_MAX) {
+            calls->stubs = realloc(calls->stubs, (calls->nstubs + 1) * sizeof(*calls->stubs));
+            calls->stubs[calls->nstubs++] = (struct plt_stub) {
+                shdr->sh_addr + offset - offset % entry_size, callee,
+            };
+        }
+        offset += length;
+    }
+}
+
+int plt_init(struct plt_calls *calls, const struct elf_file *elf)
+{
+    struct named_slot *named = NULL;
+    size_t nnamed = 0;
+
+    memset(calls, 0, sizeof(*calls));
+    for (size_t i = 0; i < elf->shnum; ++i) {
+        add_named_slots(elf, &elf->shdrs[i], &named, &nnamed);
+    }
+    if (nnamed == 0) {
+        free(named);
+        return -1;
+    }
+
+    // a symbol may have both a JUMP_SLOT and a GLOB_DAT slot
+    qsort(named, nnamed, sizeof(*named), compare_names);
+    calls->callees = calloc(nnamed, sizeof(*calls->callees));
+    calls->slots = malloc(nnamed * sizeof(*calls->slots));
+    for (size_t i = 0; i < nnamed; ++i) {
+        if (i == 0 || strcmp(named[i - 1].name, named[i].name) != 0) {
+            calls->callees[calls->ncallees++] = (struct plt_callee) { named[i].name, named[i].defined };
+        }
+        calls->slots[calls->nslots++] = (struct plt_slot) { named[i].got, calls->ncallees - 1 };
+    }
+    qsort(calls->slots, calls->nslots, sizeof(*calls->slots), compare_slots);
+    free(named);
+
+    add_stubs(calls, elf, ".plt");
+    add_stubs(calls, elf, ".plt.sec");
+    add_stubs(calls, elf, ".plt.got");
+    qsort(calls->stubs, calls->nstubs, sizeof(*calls->stubs), compare_stubs);
+    return 0;
+}
+
+size_t plt_find_calls(const struct plt_calls *calls, const struct cfg *cfg, struct plt_site **sites)
+{
+    uint64_t *loop_end = malloc(cfg->nblocks * sizeof(*loop_end));
+    cfg_loop_ends(cfg, loop_end);
+    // blocks are sorted, so a block is in a loop if an earlier head's loop extends past its start
+    uint64_t loop_until = 0;
+    size_t count = 0;
+
+    *sites = NULL;
+    for (size_t b = 0; b < cfg->nblocks; ++b) {
+        const struct cfg_block *block = &cfg->blocks[b];
+        if (loop_end[b] > loop_until) {
+            loop_until = loop_end[b];
+        }
+        bool in_loop = block->start < loop_until;
+
+        for (size_t i = block->first; i < block->first + block->count; ++i) {
+            const struct cfg_inst *inst = &cfg->insts[i];
+            const uint8_t *bytes = cfg_inst_bytes(cfg, inst);
+            struct x86_length fast;
+            if (x86_length_decode(bytes, inst->length, &fast) == 0) {
+                continue;
+            }
+
+            size_t callee = SIZE_MAX;
+            bool via_plt = false;
+            if (inst->flow == CFG_FLOW_CALL || inst->flow == CFG_FLOW_JUMP || inst->flow == CFG_FLOW_BRANCH) {
+                callee = stub_callee(calls, inst->target);
+                via_plt = true;
+            } else {
+                uint64_t got = got_operand(bytes, &fast, inst->address);
+                callee = got != 0 ? slot_callee(calls, got) : SIZE_MAX;
+            }
+            if (callee != SIZE_MAX) {
+                *sites = realloc(*sites, (count + 1) * sizeof(**sites));
+                (*sites)[count++] = (struct plt_site) { callee, via_plt, in_loop };
+            }
+        }
+    }
+
+    free(loop_end);
+    return count;
+}
+
+void plt_count_calls(struct plt_calls *calls, const struct plt_site *sites, size_t nsites, const char *caller)
+{
+    struct plt_caller counts = { caller, nsites, 0 };
+
+    if (nsites == 0) {
+        return;
+    }
+    for (size_t i = 0; i < nsites; ++i) {
+        struct plt_callee *c = &calls->callees[sites[i].callee];
+        if (sites[i].via_plt) {
+            ++c->plt_calls;
+        } else {
+            ++c->got_calls;
+        }
+        if (c->last_caller != calls->ncallers + 1) {
+            c->last_caller = calls->ncallers + 1;
+            ++c->callers;
+        }
+        if (sites[i].in_loop) {
+            ++c->loop_calls;
+            ++counts.loop_calls;
+        }
+    }
+    calls->callers = realloc(calls->callers, (calls->ncallers + 1) * sizeof(*calls->callers));
+    calls->callers[calls->ncallers++] = counts;
+}
+
+// call sites in loops first, then all call sites
+static int compare_callees(const void *a, const void *b)
+{
+    const struct plt_callee *x = *(const struct plt_callee * const *) a;
+    const struct plt_callee *y = *(const struct plt_callee * const *) b;
+
+    if (x->loop_calls != y->loop_calls) {
+        return x->loop_calls < y->loop_calls ? 1 : -1;
+    }
+    if (x->plt_calls + x->got_calls != y->plt_calls + y->got_calls) {
+        return x->plt_calls + x->got_calls < y->plt_calls + y->got_calls ? 1 : -1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+static int compare_callers(const void *a, const void *b)
+{
+    const struct plt_caller *x = a;
+    const struct plt_caller *y = b;
+
+    if (x->loop_calls != y->loop_calls) {
+        return x->loop_calls < y->loop_calls ? 1 : -1;
+    }
+    if (x->calls != y->calls) {
+        return x->calls < y->calls ? 1 : -1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+// Calls to a symbol defined here stay indirect only so that it can be
+// interposed.  Calls through a PLT stub to another module can skip the stub.
+static const char *suggestion(const struct plt_callee *callee)
+{
+    if (callee->defined) {
+        return "-Bsymbolic, hidden visibility or LTO";
+    }
+    if (callee->plt_calls != 0) {
+        return "-fno-plt";
+    }
+    return "";
+}
+
+static const char *route(const struct plt_callee *callee)
+{
+    if (callee->plt_calls != 0 && callee->got_calls != 0) {
+        return "PLT+GOT";
+    }
+    return callee->plt_calls != 0 ? "PLT" : "GOT";
+}
+
+void plt_report(const struct plt_calls *calls, FILE *out)
+{
+    const struct plt_callee **callees = malloc(calls->ncallees * sizeof(*callees));
+    size_t ncalled = 0;
+    size_t plt_total = 0;
+    size_t got_total = 0;
+
+    for (size_t i = 0; i < calls->ncallees; ++i) {
+        const struct plt_callee *callee = &calls->callees[i];
+        if (callee->plt_calls + callee->got_calls != 0) {
+            callees[ncalled++] = callee;
+            plt_total += callee->plt_calls;
+            got_total += callee->got_calls;
+        }
+    }
+    if (ncalled == 0) {
+        free(callees);
+        return;
+    }
+    qsort(callees, ncalled, sizeof(*callees), compare_callees);
+
+    fprintf(out, "%zu calls through the PLT and %zu through the GOT to %zu callees from %zu functions\n",
+            plt_total, got_total, ncalled, calls->ncallers);
+    fprintf(out, "\n%8s %8s %8s  %-7s  %s\n", "calls", "in loops", "callers", "via", "callee");
+    for (size_t i = 0; i < ncalled && i < MAX_LISTED; ++i) {
+        const struct plt_callee *callee = callees[i];
+        const char *option = suggestion(callee);
+        fprintf(out, "%8zu %8zu %8zu  %-7s  %s", callee->plt_calls + callee->got_calls, callee->loop_calls,
+                callee->callers, route(callee), callee->name);
+        if (option[0] != '\0') {
+            fprintf(out, " (%s)", option);
+        }
+        fprintf(out, "\n");
+    }
+    if (ncalled > MAX_LISTED) {
+        fprintf(out, "and %zu more callees\n", ncalled - MAX_LISTED);
+    }
+
+    struct plt_caller *callers = malloc(calls->ncallers * sizeof(*callers));
+    memcpy(callers, calls->callers, calls->ncallers * sizeof(*callers));
+    qsort(callers, calls->ncallers, sizeof(*callers), compare_callers);
+    fprintf(out, "\n%8s %8s  %s\n", "calls", "in loops", "function");
+    for (size_t i = 0; i < calls->ncallers && i < MAX_LISTED; ++i) {
+        fprintf(out, "%8zu %8zu  %s\n", callers[i].calls, callers[i].loop_calls, callers[i].name);
+    }
+    if (calls->ncallers > MAX_LISTED) {
+        fprintf(out, "and %zu more functions\n", calls->ncallers - MAX_LISTED);
+    }
+
+    free(callers);
+    free(callees);
+}
+
+void plt_free(struct plt_calls *calls)
+{
+    free(calls->callees);
+    free(calls->slots);
+    free(calls->stubs);
+    free(calls->callers);
+}
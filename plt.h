@@ -0,0 +1,99 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PLT_H__
+#define __PLT_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cfg.h"
+#include "elffile.h"
+
+// A symbol which the dynamic linker binds into one or more GOT slots.
+struct plt_callee {
+    const char *name;
+    // defined in this binary, so that only interposition keeps calls indirect
+    bool defined;
+    // call sites through a PLT stub and directly through a GOT slot
+    size_t plt_calls;
+    size_t got_calls;
+    // call sites of either kind inside a loop
+    size_t loop_calls;
+    // functions with at least one call site
+    size_t callers;
+    // index of the last function counted in callers plus one
+    size_t last_caller;
+};
+
+struct plt_slot {
+    uint64_t got;
+    size_t callee;
+};
+
+struct plt_stub {
+    uint64_t address;
+    size_t callee;
+};
+
+struct plt_caller {
+    const char *name;
+    size_t calls;
+    size_t loop_calls;
+};
+
+struct plt_calls {
+    struct plt_callee *callees;
+    size_t ncallees;
+    // sorted by address
+    struct plt_slot *slots;
+    size_t nslots;
+    struct plt_stub *stubs;
+    size_t nstubs;
+    // functions with at least one call site, in the order counted
+    struct plt_caller *callers;
+    size_t ncallers;
+};
+
+// Find the GOT slots named by JUMP_SLOT and GLOB_DAT relocations against
+// .dynsym and the stubs in .plt, .plt.sec and .plt.got which jump through
+// them.  Return -1 if the binary has no named slots.
+int plt_init(struct plt_calls *calls, const struct elf_file *elf);
+
+struct plt_site {
+    size_t callee;
+    bool via_plt;
+    bool in_loop;
+};
+
+// Find the calls, tail calls and conditional tail calls in a function which
+// reach a named GOT slot, either through a PLT stub or as CALL [RIP+disp].
+// calls is only read, so functions may be scanned in parallel.  Return the
+// number of sites; the caller frees the array.
+size_t plt_find_calls(const struct plt_calls *calls, const struct cfg *cfg, struct plt_site **sites);
+
+// add the sites plt_find_calls found in a function to the totals
+void plt_count_calls(struct plt_calls *calls, const struct plt_site *sites, size_t nsites, const char *caller);
+
+// Print the callees and calling functions with the most call sites, those in
+// loops first, and which option would bind each callee's calls directly.
+void plt_report(const struct plt_calls *calls, FILE *out);
+
+void plt_free(struct plt_calls *calls);
+
+#endif
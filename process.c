@@ -0,0 +1,474 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "cfg.h"
+#include "process.h"
+#include "x86len.h"
+#include "x86lint.h"
+
+// pagemap entry bits, see Documentation/admin-guide/mm/pagemap.rst
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+#define PAGEMAP_SWAPPED (1ULL << 62)
+#define PAGEMAP_PRESENT (1ULL << 63)
+
+// largest single read, and the window linted at once
+#define READ_BATCH (1 << 20)
+// longest x86 instruction
+#define MAX_INSTRUCTION 15
+
+ssize_t proc_mappings(pid_t pid, struct proc_mapping **mappings)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int) pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    char *line = NULL;
+    size_t line_size = 0;
+    size_t count = 0;
+    size_t capacity = 0;
+    *mappings = NULL;
+
+    // 7f0000000000-7f0000001000 r-xp 00000000 08:01 1234    /usr/lib/libc.so.6
+    while (getline(&line, &line_size, file) != -1) {
+        uint64_t start, end, offset, inode;
+        unsigned major, minor;
+        char perms[5];
+        int name_offset = 0;
+        if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %4s %" SCNx64 " %x:%x %" SCNu64 " %n",
+                   &start, &end, perms, &offset, &major, &minor, &inode, &name_offset) != 7 ||
+            name_offset == 0) {
+            continue;
+        }
+        if (perms[2] != 'x') {
+            continue;
+        }
+
+        char *name = line + name_offset;
+        name[strcspn(name, "\n")] = '\0';
+        if (count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            *mappings = realloc(*mappings, capacity * sizeof(**mappings));
+        }
+        (*mappings)[count].start = start;
+        (*mappings)[count].end = end;
+        (*mappings)[count].path = strdup(name);
+        (*mappings)[count].offset = offset;
+        (*mappings)[count].dev = makedev(major, minor);
+        (*mappings)[count].inode = inode;
+        ++count;
+    }
+
+    free(line);
+    fclose(file);
+    return count;
+}
+
+void proc_mappings_free(struct proc_mapping *mappings, size_t nmappings)
+{
+    for (size_t i = 0; i < nmappings; ++i) {
+        free(mappings[i].path);
+    }
+    free(mappings);
+}
+
+struct scan {
+    pid_t pid;
+    int mem_fd;
+    // -1 if pagemap is unreadable
+    int pagemap_fd;
+    // whether clear_refs works so rescans can skip clean pages
+    bool soft_dirty;
+    uint64_t page_size;
+    // a lead page and a window, see lint_range
+    uint8_t *buf;
+    uint64_t *entries;
+    size_t entries_size;
+    // backing file of the mapping last read from a file, or -1
+    const struct proc_mapping *file_mapping;
+    int file_fd;
+};
+
+// where a page is read from
+enum page_source {
+    // anonymous memory which was never touched and reads as zeroes
+    PAGE_NONE,
+    // /proc/pid/mem, which faults in pages that are not present
+    PAGE_MEM,
+    // the backing file, for file-backed pages the process has not faulted in
+    PAGE_FILE,
+};
+
+// page range selected for linting
+struct range {
+    const struct proc_mapping *mapping;
+    enum page_source source;
+    uint64_t start;
+    uint64_t end;
+    // Decoding starts at lead, the page before start unless start begins the
+    // mapping, so that checking starts at an instruction boundary rather
+    // than in the middle of one.
+    uint64_t lead;
+    enum page_source lead_source;
+    // page after end, which completes an instruction straddling end
+    enum page_source tail_source;
+};
+
+struct ranges {
+    struct range *ranges;
+    size_t count;
+    size_t capacity;
+};
+
+static void add_range(struct ranges *ranges, const struct range *range)
+{
+    if (ranges->count != 0) {
+        struct range *last = &ranges->ranges[ranges->count - 1];
+        if (last->mapping == range->mapping && last->source == range->source && last->end == range->start) {
+            last->end = range->end;
+            last->tail_source = range->tail_source;
+            return;
+        }
+    }
+    if (ranges->count == ranges->capacity) {
+        ranges->capacity = ranges->capacity == 0 ? 16 : ranges->capacity * 2;
+        ranges->ranges = realloc(ranges->ranges, ranges->capacity * sizeof(*ranges->ranges));
+    }
+    ranges->ranges[ranges->count++] = *range;
+}
+
+// Clearing is process-wide: it write-protects every page of the target, so
+// that its next write to each faults, and resets the bits for other users.
+static int clear_soft_dirty(const struct scan *scan)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/clear_refs", (int) scan->pid);
+    int fd = open(path, O_WRONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    int ret = write(fd, "4", 1) == 1 ? 0 : -1;
+    close(fd);
+    return ret;
+}
+
+// Kernels without CONFIG_MEM_SOFT_DIRTY accept clear_refs but never set the
+// bit.  New mappings start soft-dirty, so probe one in this process.
+static bool soft_dirty_supported(uint64_t page_size)
+{
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    volatile uint8_t *page = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uint64_t entry = 0;
+    if (page != MAP_FAILED) {
+        page[0] = 1;
+        if (pread(fd, &entry, sizeof(entry), (uintptr_t) page / page_size * sizeof(entry)) != sizeof(entry)) {
+            entry = 0;
+        }
+        munmap((void *) page, page_size);
+    }
+    close(fd);
+    return (entry & PAGEMAP_SOFT_DIRTY) != 0;
+}
+
+// Reading a page through /proc/pid/mem faults it in if it is not present,
+// which costs the process memory and I/O.  File-backed pages which are not
+// present, and so were never copied on write, hold what the file holds.
+static enum page_source page_source(uint64_t entry, bool file_backed)
+{
+    if ((entry & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED)) != 0) {
+        return PAGE_MEM;
+    }
+    return file_backed ? PAGE_FILE : PAGE_NONE;
+}
+
+// Select the pages of a mapping to lint.  Anonymous pages which were never
+// touched read as zeroes and are skipped, as are pages which have not been
+// written since the last pass when rescanning.
+static void select_pages(struct scan *scan, const struct proc_mapping *mapping, bool rescan,
+                         struct ranges *ranges)
+{
+    uint64_t npages = (mapping->end - mapping->start) / scan->page_size;
+    bool file_backed = mapping->path[0] == '/';
+
+    if (scan->pagemap_fd == -1) {
+        struct range range = {
+            mapping, PAGE_MEM, mapping->start, mapping->end, mapping->start, PAGE_NONE, PAGE_NONE,
+        };
+        add_range(ranges, &range);
+        return;
+    }
+
+    if (npages > scan->entries_size) {
+        scan->entries_size = npages;
+        scan->entries = realloc(scan->entries, npages * sizeof(*scan->entries));
+    }
+    off_t offset = mapping->start / scan->page_size * sizeof(*scan->entries);
+    ssize_t nread = pread(scan->pagemap_fd, scan->entries, npages * sizeof(*scan->entries), offset);
+    if (nread != (ssize_t) (npages * sizeof(*scan->entries))) {
+        // the mapping went away since reading maps
+        return;
+    }
+
+    enum page_source previous = PAGE_NONE;
+    enum page_source source = npages != 0 ? page_source(scan->entries[0], file_backed) : PAGE_NONE;
+    for (uint64_t i = 0; i < npages; ++i) {
+        uint64_t entry = scan->entries[i];
+        enum page_source next = i + 1 < npages ? page_source(scan->entries[i + 1], file_backed) : PAGE_NONE;
+        if (source != PAGE_NONE && !(rescan && scan->soft_dirty && (entry & PAGEMAP_SOFT_DIRTY) == 0)) {
+            uint64_t start = mapping->start + i * scan->page_size;
+            struct range range = {
+                mapping, source, start, start + scan->page_size,
+                previous != PAGE_NONE ? start - scan->page_size : start, previous, next,
+            };
+            add_range(ranges, &range);
+        }
+        previous = source;
+        source = next;
+    }
+}
+
+// Return the backing file of a mapping, opened through /proc/pid/root so that
+// paths resolve in the process's mount namespace, or -1 if it was replaced.
+static int open_file(struct scan *scan, const struct proc_mapping *mapping)
+{
+    if (scan->file_mapping == mapping) {
+        return scan->file_fd;
+    }
+    if (scan->file_fd != -1) {
+        close(scan->file_fd);
+    }
+    scan->file_mapping = mapping;
+
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "/proc/%d/root%s", (int) scan->pid, mapping->path);
+    scan->file_fd = open(path, O_RDONLY);
+    struct stat st;
+    if (scan->file_fd != -1 &&
+        (fstat(scan->file_fd, &st) != 0 || st.st_dev != mapping->dev || st.st_ino != mapping->inode)) {
+        close(scan->file_fd);
+        scan->file_fd = -1;
+    }
+    return scan->file_fd;
+}
+
+static ssize_t read_pages(struct scan *scan, const struct proc_mapping *mapping, enum page_source source,
+                          uint8_t *buf, size_t size, uint64_t addr)
+{
+    if (source == PAGE_FILE) {
+        int fd = open_file(scan, mapping);
+        return fd == -1 ? -1 : pread(fd, buf, size, mapping->offset + (addr - mapping->start));
+    }
+    return pread(scan->mem_fd, buf, size, addr);
+}
+
+static void print_mapping(void *arg, enum x86lint_rule rule, uint64_t address)
+{
+    const struct proc_mapping *mapping = arg;
+    printf("%s\n", mapping->path[0] != '\0' ? mapping->path : "[anon]");
+}
+
+// Lint len bytes at address, of which the first lead are only decoded.  If
+// consumed is non-NULL, stop at an instruction which continues past the
+// window and store where it starts.
+static int lint_bytes(const struct range *range, const uint8_t *data, uint64_t address, size_t len, size_t lead,
+                      size_t *consumed)
+{
+    struct x86lint_options options = {
+        .address = address,
+        .on_finding = print_mapping,
+        .arg = (void *) range->mapping,
+        // JIT code caches interleave data
+        .resync = true,
+        .lead = lead,
+        .consumed = consumed,
+    };
+
+    return check_instructions_with(data, len, &options);
+}
+
+// Lint the carry bytes left at the end of a range as one instruction,
+// completed from the next page.  Instructions after it belong to that page.
+static int lint_tail(struct scan *scan, const struct range *range, size_t carry)
+{
+    ssize_t nread = range->tail_source == PAGE_NONE ? -1 :
+                    read_pages(scan, range->mapping, range->tail_source, scan->buf + carry,
+                               MAX_INSTRUCTION - carry, range->end);
+    size_t len = carry + (nread > 0 ? nread : 0);
+    struct x86_length fast;
+    size_t length = x86_length_decode(scan->buf, len, &fast);
+    if (length == 0) {
+        length = cfg_xed_length(scan->buf, len);
+    }
+    // undecodable even when complete, so resync within the range
+    if (length == 0) {
+        length = carry;
+    }
+    return lint_bytes(range, scan->buf, range->end - carry, length, 0, NULL);
+}
+
+// Read a range in windows of READ_BATCH bytes and lint each as it arrives.
+// The lead page is only decoded, and an instruction which straddles two
+// windows is carried over to the next.  Pages which fail to read, like guard
+// pages or memory unmapped meanwhile, split the range.  Return the number of
+// findings and add the bytes read.
+static int lint_range(struct scan *scan, const struct range *range, uint64_t *bytes)
+{
+    int errors = 0;
+    // bytes in buf before addr, and how many of them are only decoded
+    size_t carry = 0;
+    size_t lead = 0;
+
+    for (uint64_t addr = range->lead; addr < range->end;) {
+        bool in_lead = addr < range->start;
+        uint64_t limit = in_lead ? range->start : range->end;
+        size_t want = limit - addr < READ_BATCH ? limit - addr : READ_BATCH;
+        ssize_t nread = read_pages(scan, range->mapping, in_lead ? range->lead_source : range->source,
+                                   scan->buf + carry, want, addr);
+        if (nread <= 0) {
+            errors += lint_bytes(range, scan->buf, addr - carry, carry, lead, NULL);
+            carry = 0;
+            lead = 0;
+            addr = (addr / scan->page_size + 1) * scan->page_size;
+            continue;
+        }
+        addr += nread;
+        carry += nread;
+        if (in_lead) {
+            lead += nread;
+            continue;
+        }
+        *bytes += nread;
+
+        // less than MAX_INSTRUCTION bytes are carried over
+        size_t consumed = carry;
+        errors += lint_bytes(range, scan->buf, addr - carry, carry, lead, &consumed);
+        memmove(scan->buf, scan->buf + consumed, carry - consumed);
+        carry -= consumed;
+        lead = lead > consumed ? lead - consumed : 0;
+    }
+    if (carry != 0) {
+        errors += lint_tail(scan, range, carry);
+    }
+
+    return errors;
+}
+
+// Lint the selected pages of every executable mapping.  Return -1 if the
+// process is gone, otherwise the number of findings.
+static int scan_pass(struct scan *scan, bool rescan)
+{
+    struct proc_mapping *mappings;
+    ssize_t nmappings = proc_mappings(scan->pid, &mappings);
+    struct ranges ranges = { NULL, 0, 0 };
+    uint64_t bytes = 0;
+    int errors = 0;
+
+    if (nmappings <= 0) {
+        return -1;
+    }
+
+    for (ssize_t i = 0; i < nmappings; ++i) {
+        select_pages(scan, &mappings[i], rescan, &ranges);
+    }
+
+    // Clear before reading so that writes during the pass are seen by the
+    // next one.  Writes between reading pagemap and here are missed.
+    if (scan->soft_dirty) {
+        clear_soft_dirty(scan);
+    }
+
+    for (size_t i = 0; i < ranges.count; ++i) {
+        errors += lint_range(scan, &ranges.ranges[i], &bytes);
+    }
+    if (scan->file_fd != -1) {
+        close(scan->file_fd);
+    }
+    scan->file_mapping = NULL;
+    scan->file_fd = -1;
+
+    printf("%d errors in %" PRIu64 " bytes\n", errors, bytes);
+    fflush(stdout);
+
+    free(ranges.ranges);
+    proc_mappings_free(mappings, nmappings);
+    return errors;
+}
+
+int lint_process(pid_t pid, unsigned interval)
+{
+    struct scan scan = { pid, -1, -1, false, sysconf(_SC_PAGESIZE), NULL, NULL, 0, NULL, -1 };
+    char path[64];
+    int errors = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/mem", (int) pid);
+    scan.mem_fd = open(path, O_RDONLY);
+    if (scan.mem_fd == -1) {
+        perror(path);
+        return -1;
+    }
+    scan.buf = malloc(scan.page_size + READ_BATCH);
+
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", (int) pid);
+    scan.pagemap_fd = open(path, O_RDONLY);
+    if (interval != 0) {
+        scan.soft_dirty = scan.pagemap_fd != -1 && soft_dirty_supported(scan.page_size) &&
+                          clear_soft_dirty(&scan) == 0;
+        if (!scan.soft_dirty) {
+            fprintf(stderr, "soft-dirty tracking unavailable, rescanning all pages\n");
+        }
+    }
+
+    for (bool rescan = false; ; rescan = true) {
+        int pass_errors = scan_pass(&scan, rescan);
+        if (pass_errors < 0) {
+            if (!rescan) {
+                errors = -1;
+            }
+            break;
+        }
+        errors += pass_errors;
+        if (interval == 0) {
+            break;
+        }
+        sleep(interval);
+    }
+
+    free(scan.buf);
+    free(scan.entries);
+    if (scan.pagemap_fd != -1) {
+        close(scan.pagemap_fd);
+    }
+    close(scan.mem_fd);
+    return errors;
+}
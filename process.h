@@ -0,0 +1,48 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PROCESS_H__
+#define __PROCESS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct proc_mapping {
+    uint64_t start;
+    uint64_t end;
+    // backing file, pseudo-path like [anon:jit], or empty for anonymous memory
+    char *path;
+    // offset of start in the backing file, and the file's device and inode
+    uint64_t offset;
+    dev_t dev;
+    ino_t inode;
+};
+
+// Return the executable mappings of a process in address order and their
+// count, or -1 on error.  Free with proc_mappings_free.
+ssize_t proc_mappings(pid_t pid, struct proc_mapping **mappings);
+void proc_mappings_free(struct proc_mapping *mappings, size_t nmappings);
+
+// Lint the executable mappings of a running process without stopping it.
+// File-backed pages which the process has not faulted in are read from the
+// file instead of being faulted in through its memory.  With a nonzero
+// interval, rescan every interval seconds until the process exits, only
+// re-linting pages whose soft-dirty bit is set.  Return -1 on error,
+// otherwise the number of findings reported by all passes.
+int lint_process(pid_t pid, unsigned interval);
+
+#endif
@@ -0,0 +1,552 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cfg.h"
+#include "elffile.h"
+#include "throughput.h"
+#include "x86lint.h"
+
+#define MAX_REGS 8
+// distinct sets of ports: one per class plus load, store address and data
+#define MAX_PORT_SETS (UOP_CLASS_COUNT + 3)
+// iterations simulated to reach a steady state; the second half is measured
+#define ITERATIONS 16
+
+// what an instruction costs and which registers it depends on
+struct inst_model {
+    uint64_t address;
+    enum uop_class class;
+    struct uop_cost compute;
+    bool load;
+    bool store;
+    // fused-domain uops the front-end issues
+    unsigned fused;
+    unsigned nreads;
+    unsigned nwrites;
+    // base and index registers of memory operands
+    unsigned naddress;
+    xed_reg_enum_t reads[MAX_REGS];
+    xed_reg_enum_t writes[MAX_REGS];
+    xed_reg_enum_t address_regs[MAX_REGS];
+};
+
+static const char *const bottleneck_names[THROUGHPUT_BOTTLENECK_COUNT] = {
+    [THROUGHPUT_FRONT_END] = "front-end",
+    [THROUGHPUT_PORTS] = "port",
+    [THROUGHPUT_DEPENDENCY] = "dependency chain",
+};
+
+// uops which may issue to the same set of ports
+struct port_uops {
+    uint16_t ports;
+    unsigned uops;
+};
+
+// how much an encoding finding may matter, most first
+enum finding_rank {
+    RANK_FRONT_END_LOOP,
+    RANK_CRITICAL_PATH,
+    RANK_LOOP,
+    RANK_OTHER,
+};
+
+struct finding {
+    enum x86lint_rule rule;
+    uint64_t address;
+    const char *function;
+    enum finding_rank rank;
+};
+
+struct findings {
+    struct finding *items;
+    size_t count;
+    size_t capacity;
+    const char *function;
+};
+
+// Return the register whose value an operand names, or XED_REG_INVALID for
+// registers not worth tracking.  RSP updates are handled by the stack engine
+// and never delay instructions.
+static xed_reg_enum_t tracked_register(xed_reg_enum_t reg)
+{
+    switch (xed_reg_class(reg)) {
+    case XED_REG_CLASS_FLAGS:
+    case XED_REG_CLASS_GPR:
+    case XED_REG_CLASS_MASK:
+    case XED_REG_CLASS_XMM:
+    case XED_REG_CLASS_YMM:
+    case XED_REG_CLASS_ZMM:
+        break;
+    default:
+        return XED_REG_INVALID;
+    }
+    reg = xed_get_largest_enclosing_register(reg);
+    return reg == XED_REG_RSP ? XED_REG_INVALID : reg;
+}
+
+static void add_register(xed_reg_enum_t *regs, unsigned *count, xed_reg_enum_t reg)
+{
+    reg = tracked_register(reg);
+    if (reg != XED_REG_INVALID && *count < MAX_REGS) {
+        regs[(*count)++] = reg;
+    }
+}
+
+// CMP, TEST and simple ALU instructions fuse with a following Jcc
+static bool is_fusible(const xed_decoded_inst_t *xedd)
+{
+    switch (xed_decoded_inst_get_iclass(xedd)) {
+    case XED_ICLASS_ADD: case XED_ICLASS_AND: case XED_ICLASS_CMP: case XED_ICLASS_DEC:
+    case XED_ICLASS_INC: case XED_ICLASS_SUB: case XED_ICLASS_TEST:
+        return xed_decoded_inst_number_of_memory_operands(xedd) == 0;
+    default:
+        return false;
+    }
+}
+
+static void model_inst(struct inst_model *m, const struct uarch *uarch, const xed_decoded_inst_t *xedd)
+{
+    m->class = uop_class(xedd);
+    m->compute = uarch->costs[m->class];
+
+    for (unsigned i = 0; i < xed_decoded_inst_number_of_memory_operands(xedd); ++i) {
+        m->load |= xed_decoded_inst_mem_read(xedd, i);
+        m->store |= xed_decoded_inst_mem_written(xedd, i);
+        add_register(m->address_regs, &m->naddress, xed_decoded_inst_get_base_reg(xedd, i));
+        add_register(m->address_regs, &m->naddress, xed_decoded_inst_get_index_reg(xedd, i));
+    }
+    // moves to and from memory are only the load or store
+    if ((m->class == UOP_MOV || m->class == UOP_VEC_MOV) && (m->load || m->store)) {
+        m->compute = (struct uop_cost) { 0 };
+    }
+    if (uarch->split_512 && uses_zmm(xedd)) {
+        m->compute.uops *= 2;
+        m->compute.divider *= 2;
+    }
+
+    const xed_inst_t *xi = xed_decoded_inst_inst(xedd);
+    for (unsigned i = 0; i < xed_inst_noperands(xi); ++i) {
+        const xed_operand_t *op = xed_inst_operand(xi, i);
+        xed_operand_enum_t name = xed_operand_name(op);
+        if (!xed_operand_is_register(name)) {
+            continue;
+        }
+        xed_reg_enum_t reg = xed_decoded_inst_get_reg(xedd, name);
+        if (xed_operand_read(op) && m->class != UOP_ZERO_IDIOM) {
+            add_register(m->reads, &m->nreads, reg);
+        }
+        if (xed_operand_written(op)) {
+            add_register(m->writes, &m->nwrites, reg);
+        }
+    }
+
+    // a load micro-fuses with its operation and store address with store data
+    m->fused = m->compute.uops + (m->load && m->compute.uops == 0) + m->store;
+}
+
+static struct inst_model *build_models(const struct cfg *cfg, const struct uarch *uarch)
+{
+    struct inst_model *models = calloc(cfg->ninsts, sizeof(*models));
+    bool fusible = false;
+
+    for (size_t i = 0; i < cfg->ninsts; ++i) {
+        const struct cfg_inst *inst = &cfg->insts[i];
+        struct inst_model *m = &models[i];
+        xed_decoded_inst_t xedd;
+        xed_decoded_inst_zero(&xedd);
+        xed_decoded_inst_set_mode(&xedd, XED_MACHINE_MODE_LONG_64, XED_ADDRESS_WIDTH_64b);
+
+        m->address = inst->address;
+        if (xed_decode(&xedd, cfg_inst_bytes(cfg, inst), inst->length) != XED_ERROR_NONE) {
+            m->class = UOP_NOP;
+            m->fused = 1;
+            fusible = false;
+            continue;
+        }
+        model_inst(m, uarch, &xedd);
+        if (m->class == UOP_BRANCH && fusible) {
+            // the pair issues and executes as one uop on the branch ports
+            m->fused = 0;
+            m->compute.uops = 0;
+            models[i - 1].compute.ports = m->compute.ports;
+        }
+        fusible = is_fusible(&xedd);
+    }
+    return models;
+}
+
+static void add_uops(struct port_uops *sets, unsigned *nsets, const struct uop_cost *cost)
+{
+    if (cost->uops == 0 || cost->ports == 0) {
+        return;
+    }
+    for (unsigned i = 0; i < *nsets; ++i) {
+        if (sets[i].ports == cost->ports) {
+            sets[i].uops += cost->uops;
+            return;
+        }
+    }
+    sets[(*nsets)++] = (struct port_uops) { cost->ports, cost->uops };
+}
+
+static unsigned count_ports(uint16_t ports)
+{
+    unsigned count = 0;
+    for (; ports != 0; ports &= ports - 1) {
+        ++count;
+    }
+    return count;
+}
+
+// Return the cycles the busiest set of ports needs per iteration.  The uops
+// restricted to a set of ports need at least their number divided by its size,
+// and a scheduler which balances uops across their ports reaches the largest
+// such bound.  That set is a union of the uops' port sets, so enumerate
+// whichever of the unions or the subsets of all ports is fewer.
+static double port_cycles(const struct port_uops *sets, unsigned nsets, unsigned nports, uint16_t *busiest)
+{
+    bool unions = nsets < nports;
+    uint32_t count = 1u << (unions ? nsets : nports);
+    double cycles = 0;
+
+    for (uint32_t subset = 1; subset < count; ++subset) {
+        uint16_t ports = subset;
+        if (unions) {
+            ports = 0;
+            for (unsigned i = 0; i < nsets; ++i) {
+                if (subset & (1u << i)) {
+                    ports |= sets[i].ports;
+                }
+            }
+        }
+        unsigned uops = 0;
+        for (unsigned i = 0; i < nsets; ++i) {
+            if ((sets[i].ports & ~ports) == 0) {
+                uops += sets[i].uops;
+            }
+        }
+        double subset_cycles = (double) uops / count_ports(ports);
+        if (subset_cycles > cycles) {
+            cycles = subset_cycles;
+            *busiest = ports;
+        }
+    }
+    return cycles;
+}
+
+// Return the cycles per iteration of the longest loop-carried dependency chain
+// when the instructions repeat.  If critical is non-NULL mark the instructions
+// on that chain.
+static double dependency_latency(const struct uarch *uarch, const struct inst_model *insts, size_t n, bool *critical)
+{
+    size_t total = n * ITERATIONS;
+    unsigned *finish = malloc(total * sizeof(*finish));
+    size_t *pred = malloc(total * sizeof(*pred));
+    unsigned ready[XED_REG_LAST];
+    size_t producer[XED_REG_LAST];
+
+    memset(ready, 0, sizeof(ready));
+    for (size_t r = 0; r < XED_REG_LAST; ++r) {
+        producer[r] = SIZE_MAX;
+    }
+
+    for (size_t g = 0; g < total; ++g) {
+        const struct inst_model *m = &insts[g % n];
+        unsigned start = 0;
+        size_t from = SIZE_MAX;
+        for (unsigned r = 0; r < m->nreads; ++r) {
+            if (ready[m->reads[r]] > start) {
+                start = ready[m->reads[r]];
+                from = producer[m->reads[r]];
+            }
+        }
+        unsigned address = 0;
+        size_t address_from = SIZE_MAX;
+        for (unsigned r = 0; r < m->naddress; ++r) {
+            if (ready[m->address_regs[r]] >= address) {
+                address = ready[m->address_regs[r]];
+                address_from = producer[m->address_regs[r]];
+            }
+        }
+        if (m->load) {
+            address += uarch->load.latency;
+        }
+        if (address > start) {
+            start = address;
+            from = address_from;
+        }
+
+        finish[g] = start + m->compute.latency;
+        pred[g] = from;
+        for (unsigned w = 0; w < m->nwrites; ++w) {
+            ready[m->writes[w]] = finish[g];
+            producer[m->writes[w]] = g;
+        }
+    }
+
+    size_t half = (ITERATIONS / 2 - 1) * n;
+    size_t last = (ITERATIONS - 1) * n;
+    unsigned half_finish = 0;
+    size_t end = last;
+    for (size_t i = 0; i < n; ++i) {
+        if (finish[half + i] > half_finish) {
+            half_finish = finish[half + i];
+        }
+        if (finish[last + i] > finish[end]) {
+            end = last + i;
+        }
+    }
+    double latency = (double) (finish[end] - half_finish) / (ITERATIONS / 2);
+
+    if (critical != NULL) {
+        memset(critical, 0, n * sizeof(*critical));
+        for (size_t g = end; g != SIZE_MAX && g >= half + n; g = pred[g]) {
+            critical[g % n] = true;
+        }
+    }
+
+    free(pred);
+    free(finish);
+    return latency;
+}
+
+static void estimate(const struct uarch *uarch, const struct inst_model *insts, size_t n,
+                     struct throughput_estimate *est, bool *critical)
+{
+    struct port_uops sets[MAX_PORT_SETS];
+    unsigned nsets = 0;
+    double divider = 0;
+    unsigned fused = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+        const struct inst_model *m = &insts[i];
+        fused += m->fused;
+        add_uops(sets, &nsets, &m->compute);
+        if (m->load) {
+            add_uops(sets, &nsets, &uarch->load);
+        }
+        if (m->store) {
+            add_uops(sets, &nsets, &uarch->store_address);
+            add_uops(sets, &nsets, &uarch->store_data);
+        }
+        divider += m->compute.divider;
+    }
+
+    double front_end = (double) fused / uarch->issue_width;
+    uint16_t busiest = 0;
+    double ports = port_cycles(sets, nsets, uarch->nports, &busiest);
+    est->ports = busiest;
+    if (divider >= ports) {
+        ports = divider;
+        est->ports = 0;
+    }
+    double latency = dependency_latency(uarch, insts, n, critical);
+
+    if (latency >= ports && latency >= front_end && latency > 0) {
+        est->cycles = latency;
+        est->bottleneck = THROUGHPUT_DEPENDENCY;
+    } else if (ports >= front_end && ports > 0) {
+        est->cycles = ports;
+        est->bottleneck = THROUGHPUT_PORTS;
+    } else {
+        est->cycles = front_end;
+        est->bottleneck = THROUGHPUT_FRONT_END;
+    }
+}
+
+void throughput_estimate_code(const struct uarch *uarch, const uint8_t *code, size_t size, uint64_t address,
+                              struct throughput_estimate *est)
+{
+    struct cfg cfg;
+
+    cfg_build(&cfg, code, size, address);
+    struct inst_model *models = build_models(&cfg, uarch);
+    estimate(uarch, models, cfg.ninsts, est, NULL);
+    free(models);
+    cfg_free(&cfg);
+}
+
+static void print_estimate(const struct uarch *uarch, const char *function, const char *kind, uint64_t address,
+                           size_t n, const struct throughput_estimate *est)
+{
+    printf("0x%" PRIx64 " %s: %s of %zu instructions, %.2f cycles per iteration, %s bound", address, function,
+           kind, n, est->cycles, bottleneck_names[est->bottleneck]);
+    if (est->bottleneck == THROUGHPUT_PORTS && est->ports == 0) {
+        printf(" (divider)");
+    } else if (est->bottleneck == THROUGHPUT_PORTS) {
+        const char *separator = " (";
+        for (unsigned p = 0; p < uarch->nports; ++p) {
+            if (est->ports & (1u << p)) {
+                printf("%s%s", separator, uarch->port_names[p]);
+                separator = "+";
+            }
+        }
+        printf(")");
+    }
+    printf("\n");
+}
+
+static void add_finding(void *arg, enum x86lint_rule rule, uint64_t address)
+{
+    struct findings *findings = arg;
+
+    if (findings->count == findings->capacity) {
+        findings->capacity = findings->capacity == 0 ? 64 : findings->capacity * 2;
+        findings->items = realloc(findings->items, findings->capacity * sizeof(*findings->items));
+    }
+    findings->items[findings->count++] = (struct finding) { rule, address, findings->function, RANK_OTHER };
+}
+
+// rank the findings within a loop by what limits the loop
+static void rank_findings(struct finding *findings, size_t count, const struct inst_model *insts, size_t n,
+                          uint64_t end, const struct throughput_estimate *est, const bool *critical)
+{
+    for (size_t f = 0; f < count; ++f) {
+        struct finding *finding = &findings[f];
+        if (finding->address < insts[0].address || finding->address >= end) {
+            continue;
+        }
+        enum finding_rank rank = RANK_LOOP;
+        if (est->bottleneck == THROUGHPUT_FRONT_END) {
+            rank = RANK_FRONT_END_LOOP;
+        } else if (est->bottleneck == THROUGHPUT_DEPENDENCY) {
+            for (size_t i = 0; i < n; ++i) {
+                if (insts[i].address == finding->address && critical[i]) {
+                    rank = RANK_CRITICAL_PATH;
+                }
+            }
+        }
+        if (rank < finding->rank) {
+            finding->rank = rank;
+        }
+    }
+}
+
+static void estimate_function(const struct uarch *uarch, const struct elf_symbol *sym, struct findings *findings,
+                              size_t first_finding, size_t counts[2][THROUGHPUT_BOTTLENECK_COUNT])
+{
+    struct cfg cfg;
+    struct throughput_estimate est;
+
+    cfg_build(&cfg, sym->data, sym->size, sym->address);
+    struct inst_model *models = build_models(&cfg, uarch);
+    bool *critical = malloc((cfg.ninsts + 1) * sizeof(*critical));
+    uint64_t *loop_end = malloc((cfg.nblocks + 1) * sizeof(*loop_end));
+
+    for (size_t b = 0; b < cfg.nblocks; ++b) {
+        const struct cfg_block *block = &cfg.blocks[b];
+        estimate(uarch, &models[block->first], block->count, &est, NULL);
+        print_estimate(uarch, sym->name, "block", block->start, block->count, &est);
+        ++counts[0][est.bottleneck];
+    }
+
+    cfg_loop_ends(&cfg, loop_end);
+    for (size_t head = 0; head < cfg.nblocks; ++head) {
+        if (loop_end[head] == 0) {
+            continue;
+        }
+        size_t tail = head;
+        while (tail + 1 < cfg.nblocks && cfg.blocks[tail + 1].end <= loop_end[head]) {
+            ++tail;
+        }
+        size_t first = cfg.blocks[head].first;
+        size_t n = cfg.blocks[tail].first + cfg.blocks[tail].count - first;
+        estimate(uarch, &models[first], n, &est, critical);
+        print_estimate(uarch, sym->name, "loop", cfg.blocks[head].start, n, &est);
+        ++counts[1][est.bottleneck];
+        rank_findings(findings->items + first_finding, findings->count - first_finding, &models[first], n,
+                      loop_end[head], &est, critical);
+    }
+
+    free(loop_end);
+    free(critical);
+    free(models);
+    cfg_free(&cfg);
+}
+
+static void print_counts(const char *kind, const size_t *counts)
+{
+    printf("%zu %s: %zu front-end bound, %zu port bound, %zu dependency chain bound\n",
+           counts[THROUGHPUT_FRONT_END] + counts[THROUGHPUT_PORTS] + counts[THROUGHPUT_DEPENDENCY], kind,
+           counts[THROUGHPUT_FRONT_END], counts[THROUGHPUT_PORTS], counts[THROUGHPUT_DEPENDENCY]);
+}
+
+static void print_findings(const struct findings *findings, enum finding_rank rank, const char *title)
+{
+    printf("\n%s:\n", title);
+    for (size_t f = 0; f < findings->count; ++f) {
+        const struct finding *finding = &findings->items[f];
+        if (finding->rank == rank) {
+            printf("  %s at 0x%" PRIx64 " in %s\n", x86lint_rule_name(finding->rule), finding->address,
+                   finding->function);
+        }
+    }
+}
+
+int throughput_report(const char *path, const struct uarch *uarch)
+{
+    struct elf_file elf;
+    struct elf_symbol *syms;
+    struct findings findings = { 0 };
+    size_t counts[2][THROUGHPUT_BOTTLENECK_COUNT] = { { 0 } };
+
+    if (elf_open(&elf, path) == -1) {
+        return -1;
+    }
+    ssize_t nsyms = elf_functions(&elf, &syms);
+    if (nsyms < 0) {
+        fprintf(stderr, "%s: no function symbols\n", path);
+        elf_close(&elf);
+        return -1;
+    }
+
+    printf("estimates for %s, table version %d\n", uarch->description, uarch->version);
+    for (ssize_t i = 0; i < nsyms; ++i) {
+        size_t first_finding = findings.count;
+        struct x86lint_options options = {
+            .address = syms[i].address,
+            .quiet = true,
+            .on_finding = add_finding,
+            .arg = &findings,
+        };
+        findings.function = syms[i].name;
+        check_instructions_with(syms[i].data, syms[i].size, &options);
+        estimate_function(uarch, &syms[i], &findings, first_finding, counts);
+    }
+
+    printf("\n");
+    print_counts("blocks", counts[0]);
+    print_counts("loops", counts[1]);
+
+    size_t ranks[RANK_OTHER + 1] = { 0 };
+    for (size_t f = 0; f < findings.count; ++f) {
+        ++ranks[findings.items[f].rank];
+    }
+    print_findings(&findings, RANK_FRONT_END_LOOP, "findings in front-end bound loops");
+    print_findings(&findings, RANK_CRITICAL_PATH, "findings on loop-carried dependency chains");
+    printf("\n%zu findings: %zu in front-end bound loops, %zu on loop-carried dependency chains, "
+           "%zu in other loops, %zu outside loops\n", findings.count, ranks[RANK_FRONT_END_LOOP],
+           ranks[RANK_CRITICAL_PATH], ranks[RANK_LOOP], ranks[RANK_OTHER]);
+
+    free(findings.items);
+    free(syms);
+    elf_close(&elf);
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __THROUGHPUT_H__
+#define __THROUGHPUT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uarch.h"
+
+enum throughput_bottleneck {
+    THROUGHPUT_FRONT_END,
+    THROUGHPUT_PORTS,
+    THROUGHPUT_DEPENDENCY,
+    THROUGHPUT_BOTTLENECK_COUNT,
+};
+
+struct throughput_estimate {
+    double cycles;
+    enum throughput_bottleneck bottleneck;
+    // the set of ports whose uops need the most cycles, or zero for the divider
+    uint16_t ports;
+};
+
+// Estimate the steady-state cycles per iteration of code which repeats, e.g.,
+// a loop body ending in its back-edge.
+void throughput_estimate_code(const struct uarch *uarch, const uint8_t *code, size_t size, uint64_t address,
+                              struct throughput_estimate *est);
+
+// Estimate the steady-state cycles per iteration of every basic block and
+// loop in a binary on a microarchitecture, naming whether the front-end,
+// execution ports or a loop-carried dependency chain limits each.  Then rank
+// encoding findings by whether they sit in front-end bound loops or on
+// critical dependency chains.  Return -1 on error.
+int throughput_report(const char *path, const struct uarch *uarch);
+
+#endif
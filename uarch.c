@@ -0,0 +1,330 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "uarch.h"
+
+#define P(n) (1u << (n))
+
+// Skylake client: four ALU ports, two load ports and a store data port.
+// Numbers follow measured uop counts, ports and latencies for the common
+// register forms.
+static const char *const skl_ports[] = { "p0", "p1", "p2", "p3", "p4", "p5", "p6", "p7" };
+#define SKL_ALU (P(0) | P(1) | P(5) | P(6))
+
+// Ice Lake client adds a second store data port and separate store address
+// ports and has a faster integer divider.
+static const char *const icl_ports[] = { "p0", "p1", "p2", "p3", "p4", "p5", "p6", "p7", "p8", "p9" };
+#define ICL_ALU SKL_ALU
+
+// Zen 3 and Zen 4: four integer ALUs, three AGUs and four FP pipes.
+static const char *const zen_ports[] = {
+    "alu0", "alu1", "alu2", "alu3", "agu0", "agu1", "agu2", "fp0", "fp1", "fp2", "fp3",
+};
+#define ZEN_ALU (P(0) | P(1) | P(2) | P(3))
+#define ZEN_AGU (P(4) | P(5) | P(6))
+#define ZEN_FP (P(7) | P(8) | P(9) | P(10))
+
+static const struct uarch uarchs[] = {
+    {
+        "skl", "Intel Skylake", 2, 4, 8, skl_ports,
+        {
+            [UOP_ALU] = { 1, SKL_ALU, 1, 0 },
+            [UOP_SHIFT] = { 1, P(0) | P(6), 1, 0 },
+            [UOP_IMUL] = { 1, P(1), 3, 0 },
+            [UOP_DIV32] = { 10, SKL_ALU, 26, 6 },
+            [UOP_DIV64] = { 36, SKL_ALU, 42, 24 },
+            [UOP_LEA] = { 1, P(1) | P(5), 1, 0 },
+            [UOP_LEA_SLOW] = { 1, P(1), 3, 0 },
+            [UOP_MOV] = { 1, SKL_ALU, 1, 0 },
+            [UOP_CMOV] = { 1, P(0) | P(6), 1, 0 },
+            [UOP_SETCC] = { 1, P(0) | P(6), 1, 0 },
+            [UOP_BRANCH] = { 1, P(0) | P(6), 1, 0 },
+            [UOP_JUMP] = { 1, P(6), 1, 0 },
+            [UOP_NOP] = { 1, 0, 0, 0 },
+            [UOP_ZERO_IDIOM] = { 1, 0, 0, 0 },
+            [UOP_MICROCODE] = { 20, SKL_ALU, 20, 0 },
+            [UOP_VEC_ALU] = { 1, P(0) | P(1) | P(5), 1, 0 },
+            [UOP_VEC_MOV] = { 1, P(0) | P(1) | P(5), 1, 0 },
+            [UOP_SHUFFLE] = { 1, P(5), 1, 0 },
+            [UOP_FADD] = { 1, P(0) | P(1), 4, 0 },
+            [UOP_FMUL] = { 1, P(0) | P(1), 4, 0 },
+            [UOP_FMA] = { 1, P(0) | P(1), 4, 0 },
+            [UOP_FDIV] = { 1, P(0), 11, 4 },
+            [UOP_SQRT] = { 1, P(0), 12, 6 },
+            [UOP_VEC_IMUL] = { 1, P(0) | P(1), 5, 0 },
+            [UOP_CONVERT] = { 1, P(0) | P(1), 4, 0 },
+        },
+        { 1, P(2) | P(3), 5, 0 },
+        { 1, P(2) | P(3) | P(7), 0, 0 },
+        { 1, P(4), 0, 0 },
+        false,
+    },
+    {
+        "icl", "Intel Ice Lake", 2, 5, 10, icl_ports,
+        {
+            [UOP_ALU] = { 1, ICL_ALU, 1, 0 },
+            [UOP_SHIFT] = { 1, P(0) | P(6), 1, 0 },
+            [UOP_IMUL] = { 1, P(1), 3, 0 },
+            [UOP_DIV32] = { 4, ICL_ALU, 12, 6 },
+            [UOP_DIV64] = { 4, ICL_ALU, 15, 10 },
+            [UOP_LEA] = { 1, P(1) | P(5), 1, 0 },
+            [UOP_LEA_SLOW] = { 1, P(1), 3, 0 },
+            [UOP_MOV] = { 1, ICL_ALU, 1, 0 },
+            [UOP_CMOV] = { 1, P(0) | P(6), 1, 0 },
+            [UOP_SETCC] = { 1, P(0) | P(6), 1, 0 },
+            [UOP_BRANCH] = { 1, P(0) | P(6), 1, 0 },
+            [UOP_JUMP] = { 1, P(6), 1, 0 },
+            [UOP_NOP] = { 1, 0, 0, 0 },
+            [UOP_ZERO_IDIOM] = { 1, 0, 0, 0 },
+            [UOP_MICROCODE] = { 20, ICL_ALU, 20, 0 },
+            [UOP_VEC_ALU] = { 1, P(0) | P(1) | P(5), 1, 0 },
+            [UOP_VEC_MOV] = { 1, P(0) | P(1) | P(5), 1, 0 },
+            [UOP_SHUFFLE] = { 1, P(5), 1, 0 },
+            [UOP_FADD] = { 1, P(0) | P(1), 4, 0 },
+            [UOP_FMUL] = { 1, P(0) | P(1), 4, 0 },
+            [UOP_FMA] = { 1, P(0) | P(1), 4, 0 },
+            [UOP_FDIV] = { 1, P(0), 11, 3 },
+            [UOP_SQRT] = { 1, P(0), 12, 6 },
+            [UOP_VEC_IMUL] = { 1, P(0) | P(1), 5, 0 },
+            [UOP_CONVERT] = { 1, P(0) | P(1), 4, 0 },
+        },
+        { 1, P(2) | P(3), 5, 0 },
+        { 1, P(7) | P(8), 0, 0 },
+        { 1, P(4) | P(9), 0, 0 },
+        false,
+    },
+    {
+        "zen3", "AMD Zen 3", 2, 6, 11, zen_ports,
+        {
+            [UOP_ALU] = { 1, ZEN_ALU, 1, 0 },
+            [UOP_SHIFT] = { 1, P(1) | P(2), 1, 0 },
+            [UOP_IMUL] = { 1, P(1), 3, 0 },
+            [UOP_DIV32] = { 2, P(2), 10, 6 },
+            [UOP_DIV64] = { 2, P(2), 14, 10 },
+            [UOP_LEA] = { 1, ZEN_ALU, 1, 0 },
+            [UOP_LEA_SLOW] = { 1, ZEN_ALU, 2, 0 },
+            [UOP_MOV] = { 1, ZEN_ALU, 1, 0 },
+            [UOP_CMOV] = { 1, ZEN_ALU, 1, 0 },
+            [UOP_SETCC] = { 1, P(0) | P(3), 1, 0 },
+            [UOP_BRANCH] = { 1, P(0) | P(3), 1, 0 },
+            [UOP_JUMP] = { 1, P(0) | P(3), 1, 0 },
+            [UOP_NOP] = { 1, 0, 0, 0 },
+            [UOP_ZERO_IDIOM] = { 1, 0, 0, 0 },
+            [UOP_MICROCODE] = { 20, ZEN_ALU, 20, 0 },
+            [UOP_VEC_ALU] = { 1, ZEN_FP, 1, 0 },
+            [UOP_VEC_MOV] = { 1, ZEN_FP, 1, 0 },
+            [UOP_SHUFFLE] = { 1, P(8) | P(9), 1, 0 },
+            [UOP_FADD] = { 1, P(9) | P(10), 3, 0 },
+            [UOP_FMUL] = { 1, P(7) | P(8), 3, 0 },
+            [UOP_FMA] = { 1, P(7) | P(8), 4, 0 },
+            [UOP_FDIV] = { 1, P(8), 11, 4 },
+            [UOP_SQRT] = { 1, P(8), 14, 6 },
+            [UOP_VEC_IMUL] = { 1, P(7), 3, 0 },
+            [UOP_CONVERT] = { 1, P(9) | P(10), 4, 0 },
+        },
+        { 1, ZEN_AGU, 4, 0 },
+        { 1, P(5) | P(6), 0, 0 },
+        // store data uses the integer and FP pipes without a dedicated port
+        { 0, 0, 0, 0 },
+        false,
+    },
+    {
+        "zen4", "AMD Zen 4", 2, 6, 11, zen_ports,
+        {
+            [UOP_ALU] = { 1, ZEN_ALU, 1, 0 },
+            [UOP_SHIFT] = { 1, P(1) | P(2), 1, 0 },
+            [UOP_IMUL] = { 1, P(1), 3, 0 },
+            [UOP_DIV32] = { 2, P(2), 10, 6 },
+            [UOP_DIV64] = { 2, P(2), 14, 7 },
+            [UOP_LEA] = { 1, ZEN_ALU, 1, 0 },
+            [UOP_LEA_SLOW] = { 1, ZEN_ALU, 2, 0 },
+            [UOP_MOV] = { 1, ZEN_ALU, 1, 0 },
+            [UOP_CMOV] = { 1, ZEN_ALU, 1, 0 },
+            [UOP_SETCC] = { 1, P(0) | P(3), 1, 0 },
+            [UOP_BRANCH] = { 1, P(0) | P(3), 1, 0 },
+            [UOP_JUMP] = { 1, P(0) | P(3), 1, 0 },
+            [UOP_NOP] = { 1, 0, 0, 0 },
+            [UOP_ZERO_IDIOM] = { 1, 0, 0, 0 },
+            [UOP_MICROCODE] = { 20, ZEN_ALU, 20, 0 },
+            [UOP_VEC_ALU] = { 1, ZEN_FP, 1, 0 },
+            [UOP_VEC_MOV] = { 1, ZEN_FP, 1, 0 },
+            [UOP_SHUFFLE] = { 1, P(8) | P(9), 1, 0 },
+            [UOP_FADD] = { 1, P(9) | P(10), 3, 0 },
+            [UOP_FMUL] = { 1, P(7) | P(8), 3, 0 },
+            [UOP_FMA] = { 1, P(7) | P(8), 4, 0 },
+            [UOP_FDIV] = { 1, P(8), 11, 3 },
+            [UOP_SQRT] = { 1, P(8), 14, 5 },
+            [UOP_VEC_IMUL] = { 1, P(7), 3, 0 },
+            [UOP_CONVERT] = { 1, P(9) | P(10), 4, 0 },
+        },
+        { 1, ZEN_AGU, 4, 0 },
+        { 1, P(5) | P(6), 0, 0 },
+        { 0, 0, 0, 0 },
+        true,
+    },
+};
+
+const struct uarch *uarch_find(const char *name)
+{
+    for (size_t i = 0; i < sizeof(uarchs) / sizeof(uarchs[0]); ++i) {
+        if (strcmp(uarchs[i].name, name) == 0) {
+            return &uarchs[i];
+        }
+    }
+    return NULL;
+}
+
+void uarch_print_names(FILE *out)
+{
+    for (size_t i = 0; i < sizeof(uarchs) / sizeof(uarchs[0]); ++i) {
+        fprintf(out, "%s%s", i == 0 ? "" : "|", uarchs[i].name);
+    }
+}
+
+// return the class of the widest vector register an instruction uses or
+// XED_REG_CLASS_INVALID
+static xed_reg_class_enum_t vector_class(const xed_decoded_inst_t *xedd)
+{
+    const xed_inst_t *xi = xed_decoded_inst_inst(xedd);
+    xed_reg_class_enum_t widest = XED_REG_CLASS_INVALID;
+
+    for (unsigned i = 0; i < xed_inst_noperands(xi); ++i) {
+        xed_operand_enum_t name = xed_operand_name(xed_inst_operand(xi, i));
+        if (!xed_operand_is_register(name)) {
+            continue;
+        }
+        xed_reg_class_enum_t class = xed_reg_class(xed_decoded_inst_get_reg(xedd, name));
+        if (class == XED_REG_CLASS_ZMM ||
+            (class == XED_REG_CLASS_YMM && widest != XED_REG_CLASS_ZMM) ||
+            (class == XED_REG_CLASS_XMM && widest == XED_REG_CLASS_INVALID)) {
+            widest = class;
+        }
+    }
+    return widest;
+}
+
+bool uses_zmm(const xed_decoded_inst_t *xedd)
+{
+    return vector_class(xedd) == XED_REG_CLASS_ZMM;
+}
+
+static bool is_zero_idiom(const xed_decoded_inst_t *xedd)
+{
+    switch (xed_decoded_inst_get_iclass(xedd)) {
+    case XED_ICLASS_SUB: case XED_ICLASS_XOR:
+    case XED_ICLASS_PXOR: case XED_ICLASS_VPXOR:
+    case XED_ICLASS_XORPS: case XED_ICLASS_VXORPS:
+    case XED_ICLASS_XORPD: case XED_ICLASS_VXORPD:
+        break;
+    default:
+        return false;
+    }
+    if (xed_decoded_inst_number_of_memory_operands(xedd) != 0) {
+        return false;
+    }
+    // VEX forms have a separate destination
+    xed_reg_enum_t src1 = xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG1);
+    xed_reg_enum_t src2 = xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG2);
+    if (src2 != XED_REG_INVALID && xed_reg_class(src2) != XED_REG_CLASS_FLAGS) {
+        return src1 == src2;
+    }
+    return xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG0) == src1;
+}
+
+enum uop_class uop_class(const xed_decoded_inst_t *xedd)
+{
+    if (is_zero_idiom(xedd)) {
+        return UOP_ZERO_IDIOM;
+    }
+
+    switch (xed_decoded_inst_get_iclass(xedd)) {
+    case XED_ICLASS_IMUL: case XED_ICLASS_MUL:
+        return UOP_IMUL;
+    case XED_ICLASS_DIV: case XED_ICLASS_IDIV:
+        return xed_decoded_inst_get_operand_width(xedd) == 64 ? UOP_DIV64 : UOP_DIV32;
+    case XED_ICLASS_LEA:
+        return xed_decoded_inst_get_base_reg(xedd, 0) != XED_REG_INVALID &&
+               xed_decoded_inst_get_index_reg(xedd, 0) != XED_REG_INVALID &&
+               xed_decoded_inst_get_memory_displacement_width(xedd, 0) != 0 ? UOP_LEA_SLOW : UOP_LEA;
+    case XED_ICLASS_ADDPD: case XED_ICLASS_ADDPS: case XED_ICLASS_ADDSD: case XED_ICLASS_ADDSS:
+    case XED_ICLASS_SUBPD: case XED_ICLASS_SUBPS: case XED_ICLASS_SUBSD: case XED_ICLASS_SUBSS:
+    case XED_ICLASS_VADDPD: case XED_ICLASS_VADDPS: case XED_ICLASS_VADDSD: case XED_ICLASS_VADDSS:
+    case XED_ICLASS_VSUBPD: case XED_ICLASS_VSUBPS: case XED_ICLASS_VSUBSD: case XED_ICLASS_VSUBSS:
+        return UOP_FADD;
+    case XED_ICLASS_MULPD: case XED_ICLASS_MULPS: case XED_ICLASS_MULSD: case XED_ICLASS_MULSS:
+    case XED_ICLASS_VMULPD: case XED_ICLASS_VMULPS: case XED_ICLASS_VMULSD: case XED_ICLASS_VMULSS:
+        return UOP_FMUL;
+    case XED_ICLASS_DIVPD: case XED_ICLASS_DIVPS: case XED_ICLASS_DIVSD: case XED_ICLASS_DIVSS:
+    case XED_ICLASS_VDIVPD: case XED_ICLASS_VDIVPS: case XED_ICLASS_VDIVSD: case XED_ICLASS_VDIVSS:
+        return UOP_FDIV;
+    case XED_ICLASS_SQRTPD: case XED_ICLASS_SQRTPS: case XED_ICLASS_SQRTSD: case XED_ICLASS_SQRTSS:
+    case XED_ICLASS_VSQRTPD: case XED_ICLASS_VSQRTPS: case XED_ICLASS_VSQRTSD: case XED_ICLASS_VSQRTSS:
+        return UOP_SQRT;
+    case XED_ICLASS_PMADDWD: case XED_ICLASS_PMULLD: case XED_ICLASS_PMULLW: case XED_ICLASS_PMULUDQ:
+    case XED_ICLASS_VPMADDWD: case XED_ICLASS_VPMULLD: case XED_ICLASS_VPMULLW: case XED_ICLASS_VPMULUDQ:
+        return UOP_VEC_IMUL;
+    case XED_ICLASS_PALIGNR: case XED_ICLASS_PSHUFB: case XED_ICLASS_PSHUFD:
+    case XED_ICLASS_SHUFPD: case XED_ICLASS_SHUFPS:
+    case XED_ICLASS_UNPCKHPD: case XED_ICLASS_UNPCKHPS: case XED_ICLASS_UNPCKLPD: case XED_ICLASS_UNPCKLPS:
+    case XED_ICLASS_PUNPCKHQDQ: case XED_ICLASS_PUNPCKLQDQ:
+    case XED_ICLASS_VPALIGNR: case XED_ICLASS_VPSHUFB: case XED_ICLASS_VPSHUFD:
+    case XED_ICLASS_VSHUFPD: case XED_ICLASS_VSHUFPS:
+    case XED_ICLASS_VUNPCKHPD: case XED_ICLASS_VUNPCKHPS: case XED_ICLASS_VUNPCKLPD: case XED_ICLASS_VUNPCKLPS:
+    case XED_ICLASS_VPUNPCKHQDQ: case XED_ICLASS_VPUNPCKLQDQ:
+    case XED_ICLASS_VPERMD: case XED_ICLASS_VPERMQ: case XED_ICLASS_VPERMPS: case XED_ICLASS_VPERMPD:
+    case XED_ICLASS_VPERM2F128: case XED_ICLASS_VPERM2I128:
+    case XED_ICLASS_VINSERTF128: case XED_ICLASS_VINSERTI128:
+    case XED_ICLASS_VEXTRACTF128: case XED_ICLASS_VEXTRACTI128:
+        return UOP_SHUFFLE;
+    default:
+        break;
+    }
+
+    bool vector = vector_class(xedd) != XED_REG_CLASS_INVALID;
+    switch (xed_decoded_inst_get_category(xedd)) {
+    case XED_CATEGORY_NOP: case XED_CATEGORY_WIDENOP:
+        return UOP_NOP;
+    case XED_CATEGORY_SHIFT: case XED_CATEGORY_ROTATE:
+        return vector ? UOP_VEC_ALU : UOP_SHIFT;
+    case XED_CATEGORY_CMOV:
+        return UOP_CMOV;
+    case XED_CATEGORY_SETCC:
+        return UOP_SETCC;
+    case XED_CATEGORY_COND_BR:
+        return UOP_BRANCH;
+    case XED_CATEGORY_UNCOND_BR: case XED_CATEGORY_CALL: case XED_CATEGORY_RET:
+        return UOP_JUMP;
+    case XED_CATEGORY_PUSH: case XED_CATEGORY_POP:
+        return UOP_MOV;
+    case XED_CATEGORY_VFMA:
+        return UOP_FMA;
+    case XED_CATEGORY_INTERRUPT: case XED_CATEGORY_IO: case XED_CATEGORY_SEMAPHORE:
+    case XED_CATEGORY_STRINGOP: case XED_CATEGORY_SYSCALL: case XED_CATEGORY_SYSTEM:
+        return UOP_MICROCODE;
+    case XED_CATEGORY_CONVERT:
+        return vector ? UOP_CONVERT : UOP_ALU;
+    case XED_CATEGORY_DATAXFER:
+        return vector ? UOP_VEC_MOV : UOP_MOV;
+    default:
+        break;
+    }
+    if (xed_operand_values_has_lock_prefix(xed_decoded_inst_operands_const(xedd))) {
+        return UOP_MICROCODE;
+    }
+    return vector ? UOP_VEC_ALU : UOP_ALU;
+}
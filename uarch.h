@@ -0,0 +1,100 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __UARCH_H__
+#define __UARCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "xed/xed-interface.h"
+
+// Instructions which share execution resources and latency.  Tables are keyed
+// by class rather than iform since the memory forms of an iform are modeled
+// as the register form plus load and store uops.
+enum uop_class {
+    UOP_ALU,
+    UOP_SHIFT,
+    UOP_IMUL,
+    UOP_DIV32,
+    UOP_DIV64,
+    UOP_LEA,
+    // LEA with base, index and displacement
+    UOP_LEA_SLOW,
+    // register moves; moves to or from memory are only loads or stores
+    UOP_MOV,
+    UOP_CMOV,
+    UOP_SETCC,
+    UOP_BRANCH,
+    // JMP, CALL and RET
+    UOP_JUMP,
+    UOP_NOP,
+    // XOR and SUB of a register with itself, handled at rename
+    UOP_ZERO_IDIOM,
+    // string, system and locked instructions
+    UOP_MICROCODE,
+    UOP_VEC_ALU,
+    UOP_VEC_MOV,
+    UOP_SHUFFLE,
+    UOP_FADD,
+    UOP_FMUL,
+    UOP_FMA,
+    UOP_FDIV,
+    UOP_SQRT,
+    UOP_VEC_IMUL,
+    UOP_CONVERT,
+    UOP_CLASS_COUNT,
+};
+
+struct uop_cost {
+    // fused-domain uops, each issued to one of ports
+    uint8_t uops;
+    uint16_t ports;
+    uint8_t latency;
+    // cycles the instruction occupies the non-pipelined divider
+    uint8_t divider;
+};
+
+struct uarch {
+    const char *name;
+    const char *description;
+    // incremented whenever the numbers change so that reports can be compared
+    int version;
+    // fused-domain uops renamed per cycle
+    unsigned issue_width;
+    unsigned nports;
+    const char *const *port_names;
+    struct uop_cost costs[UOP_CLASS_COUNT];
+    struct uop_cost load;
+    struct uop_cost store_address;
+    struct uop_cost store_data;
+    // 512-bit instructions issue as two 256-bit halves
+    bool split_512;
+};
+
+// return the microarchitecture named name or NULL
+const struct uarch *uarch_find(const char *name);
+
+// print the names uarch_find accepts separated by |
+void uarch_print_names(FILE *out);
+
+enum uop_class uop_class(const xed_decoded_inst_t *xedd);
+
+// return true if an instruction reads or writes a ZMM register
+bool uses_zmm(const xed_decoded_inst_t *xedd);
+
+#endif
@@ -0,0 +1,327 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "x86len.h"
+
+// Table entries describe the bytes following each opcode.
+#define M 0x01        // ModRM byte
+#define IB (1 << 1)   // 8-bit immediate
+#define IW (2 << 1)   // 16-bit immediate
+#define IZ (3 << 1)   // 16- or 32-bit immediate depending on operand size
+#define IV (4 << 1)   // 16-, 32- or 64-bit immediate depending on operand size
+#define IWB (5 << 1)  // 16-bit and 8-bit immediates (ENTER)
+#define MO (6 << 1)   // 32- or 64-bit memory offset depending on address size
+#define G3 (7 << 1)   // immediate only for TEST in group 3
+#define IMM_MASK (7 << 1)
+#define R 0x10        // immediate is a branch displacement
+#define X 0x20        // invalid in 64-bit mode, prefix, escape, or not handled
+
+static const uint8_t one_byte[256] = {
+    M, M, M, M, IB, IZ, X, X, M, M, M, M, IB, IZ, X, X,  // 00
+    M, M, M, M, IB, IZ, X, X, M, M, M, M, IB, IZ, X, X,  // 10
+    M, M, M, M, IB, IZ, X, X, M, M, M, M, IB, IZ, X, X,  // 20
+    M, M, M, M, IB, IZ, X, X, M, M, M, M, IB, IZ, X, X,  // 30
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,  // 40
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,  // 50
+    X, X, X, M, X, X, X, X, IZ, M|IZ, IB, M|IB, 0, 0, 0, 0,  // 60
+    R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB, R|IB,  // 70
+    M|IB, M|IZ, X, M|IB, M, M, M, M, M, M, M, M, M, M, M, M,  // 80
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, X, 0, 0, 0, 0, 0,  // 90
+    MO, MO, MO, MO, 0, 0, 0, 0, IB, IZ, 0, 0, 0, 0, 0, 0,  // A0
+    IB, IB, IB, IB, IB, IB, IB, IB, IV, IV, IV, IV, IV, IV, IV, IV,  // B0
+    M|IB, M|IB, IW, 0, X, X, M|IB, M|IZ, IWB, 0, IW, 0, 0, IB, X, 0,  // C0
+    M, M, M, M, X, X, X, 0, M, M, M, M, M, M, M, M,  // D0
+    R|IB, R|IB, R|IB, R|IB, IB, IB, IB, IB, R|IZ, R|IZ, X, R|IB, 0, 0, 0, 0,  // E0
+    X, 0, X, X, 0, 0, M|G3, M|G3, 0, 0, 0, 0, 0, 0, M, M,  // F0
+};
+static const uint8_t two_byte[256] = {
+    M, M, M, M, X, 0, 0, 0, 0, 0, X, 0, X, M, 0, X,  // 00
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,  // 10
+    M, M, M, M, X, X, X, X, M, M, M, M, M, M, M, M,  // 20
+    0, 0, 0, 0, 0, 0, X, 0, X, X, X, X, X, X, X, X,  // 30
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,  // 40
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,  // 50
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,  // 60
+    M|IB, M|IB, M|IB, M|IB, M, M, M, 0, M, M, X, X, M, M, M, M,  // 70
+    R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ, R|IZ,  // 80
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,  // 90
+    0, 0, 0, M, M|IB, M, X, X, 0, 0, 0, M, M|IB, M, M, M,  // A0
+    M, M, M, M, M, M, M, M, M, M, M|IB, M, M, M, M, M,  // B0
+    M, M, M|IB, M, M|IB, M|IB, M|IB, M, 0, 0, 0, 0, 0, 0, 0, 0,  // C0
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,  // D0
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,  // E0
+    M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,  // F0
+};
+
+// 0F 38 opcodes defined without a VEX or EVEX prefix: 00-0B, 10, 14-15, 17,
+// 1C-1E, 20-25, 28-2B, 30-35, 37-41, 80-82, C8-CD, CF, DB-DF, F0-F1, F5-F6, F8-F9
+static const uint8_t legacy_0f38[32] = {
+    0xff, 0x0f, 0xb1, 0x70, 0x3f, 0x0f, 0xbf, 0xff,
+    0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0xbf, 0x00, 0xf8, 0x00, 0x00, 0x63, 0x03,
+};
+
+// 0F 3A opcodes defined without a VEX or EVEX prefix: 08-0F, 14-17, 20-22,
+// 40-42, 44, 60-63, CC, CE-CF, DF
+static const uint8_t legacy_0f3a[32] = {
+    0x00, 0xff, 0xf0, 0x00, 0x07, 0x00, 0x00, 0x00,
+    0x17, 0x00, 0x00, 0x00, 0x0f, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0xd0, 0x00, 0x80, 0x00, 0x00, 0x00, 0x00,
+};
+
+static bool test_bit(const uint8_t *bitmap, uint8_t bit)
+{
+    return (bitmap[bit / 8] >> (bit % 8)) & 1;
+}
+
+// Return the size of the ModRM, SIB and displacement bytes at p or zero if
+// they extend past end.
+static size_t decode_modrm(const uint8_t *p, const uint8_t *end, struct x86_length *out)
+{
+    if (p >= end) {
+        return 0;
+    }
+    uint8_t modrm = p[0];
+    uint8_t mod = modrm >> 6;
+    uint8_t rm = modrm & 7;
+    size_t size = 1;
+
+    out->has_modrm = true;
+    out->modrm = modrm;
+    out->disp_size = 0;
+    if (mod != 3 && rm == 4) {
+        if (p + 1 >= end) {
+            return 0;
+        }
+        // SIB byte; base 5 without a displacement means disp32 with no base
+        if (mod == 0 && (p[1] & 7) == 5) {
+            out->disp_size = 4;
+        }
+        ++size;
+    }
+    if (mod == 0 && rm == 5) {
+        out->disp_size = 4;
+        out->rip_relative = true;
+    } else if (mod == 1) {
+        out->disp_size = 1;
+    } else if (mod == 2) {
+        out->disp_size = 4;
+    }
+    size += out->disp_size;
+    if ((size_t) (end - p) < size) {
+        return 0;
+    }
+    return size;
+}
+
+size_t x86_length_decode(const uint8_t *inst, size_t len, struct x86_length *out)
+{
+    const uint8_t *p = inst;
+    const uint8_t *end = inst + (len < 15 ? len : 15);
+    uint8_t flags;
+
+    memset(out, 0, sizeof(*out));
+
+    // legacy prefixes
+    for (;; ++p) {
+        if (p >= end) {
+            return 0;
+        }
+        switch (*p) {
+        case 0x26:
+        case 0x2e:
+        case 0x36:
+        case 0x3e:
+        case 0x64:
+        case 0x65:
+            continue;
+        case 0x66:
+            out->opsize = true;
+            continue;
+        case 0x67:
+            out->addrsize = true;
+            continue;
+        case 0xf0:
+            out->lock = true;
+            continue;
+        case 0xf2:
+            out->repne = true;
+            out->rep = false;
+            continue;
+        case 0xf3:
+            out->rep = true;
+            out->repne = false;
+            continue;
+        default:
+            break;
+        }
+        break;
+    }
+
+    if ((*p & 0xf0) == 0x40) {
+        out->rex = *p++;
+        if (p >= end) {
+            return 0;
+        }
+    }
+
+    if (*p == 0xc4 || *p == 0xc5 || *p == 0x62) {
+        // VEX and EVEX may not follow REX, 66, F2, F3 or LOCK
+        if (out->rex != 0 || out->opsize || out->rep || out->repne || out->lock) {
+            return 0;
+        }
+        size_t prefix_size;
+        if (*p == 0xc5) {
+            out->encoding = X86_ENCODING_VEX2;
+            out->map = 1;
+            prefix_size = 2;
+        } else if (*p == 0xc4) {
+            out->encoding = X86_ENCODING_VEX3;
+            prefix_size = 3;
+        } else {
+            out->encoding = X86_ENCODING_EVEX;
+            prefix_size = 4;
+        }
+        if ((size_t) (end - p) < prefix_size + 1) {
+            return 0;
+        }
+        if (out->encoding == X86_ENCODING_VEX3) {
+            out->map = p[1] & 0x1f;
+        } else if (out->encoding == X86_ENCODING_EVEX) {
+            // reserved bits must be zero and one respectively
+            if ((p[1] & 0x08) != 0 || (p[2] & 0x04) == 0) {
+                return 0;
+            }
+            out->map = p[1] & 0x07;
+        }
+        if (out->map < 1 || out->map > 3) {
+            return 0;
+        }
+        p += prefix_size;
+        out->opcode_offset = p - inst;
+        out->opcode = *p++;
+        // VZEROUPPER and VZEROALL are the only VEX instructions without ModRM
+        if (out->map == 1 && out->opcode == 0x77 && out->encoding != X86_ENCODING_EVEX) {
+            out->length = p - inst;
+            return out->length;
+        }
+        size_t modrm_size = decode_modrm(p, end, out);
+        if (modrm_size == 0) {
+            return 0;
+        }
+        p += modrm_size;
+        if (out->map == 3 ||
+            (out->map == 1 && ((out->opcode >= 0x70 && out->opcode <= 0x73) ||
+                               out->opcode == 0xc2 || (out->opcode >= 0xc4 && out->opcode <= 0xc6)))) {
+            out->imm_size = 1;
+        }
+        if ((size_t) (end - p) < out->imm_size) {
+            return 0;
+        }
+        out->length = p + out->imm_size - inst;
+        return out->length;
+    }
+
+    out->opcode_offset = p - inst;
+    if (*p == 0x0f) {
+        if (++p >= end) {
+            return 0;
+        }
+        if (*p == 0x38 || *p == 0x3a) {
+            out->map = *p == 0x38 ? 2 : 3;
+            if (++p >= end) {
+                return 0;
+            }
+            out->opcode = *p++;
+            if (!test_bit(out->map == 2 ? legacy_0f38 : legacy_0f3a, out->opcode)) {
+                return 0;
+            }
+            flags = out->map == 2 ? M : M | IB;
+        } else {
+            out->map = 1;
+            out->opcode = *p++;
+            flags = two_byte[out->opcode];
+            // EXTRQ and INSERTQ, and JMPE without the POPCNT prefix
+            if (((out->opcode == 0x78 || out->opcode == 0x79) && (out->opsize || out->repne)) ||
+                (out->opcode == 0xb8 && !out->rep)) {
+                return 0;
+            }
+        }
+    } else {
+        out->opcode = *p++;
+        flags = one_byte[out->opcode];
+        // XOP shares its first byte with POP r/m
+        if (out->opcode == 0x8f && (p >= end || (*p & 0x38) != 0)) {
+            return 0;
+        }
+    }
+
+    if (flags & X) {
+        return 0;
+    }
+    // rel16 branches with an operand size prefix differ between vendors
+    if ((flags & R) && (flags & IMM_MASK) == IZ && out->opsize) {
+        return 0;
+    }
+
+    if (flags & M) {
+        size_t modrm_size = decode_modrm(p, end, out);
+        if (modrm_size == 0) {
+            return 0;
+        }
+        p += modrm_size;
+    }
+
+    bool rexw = (out->rex & 0x08) != 0;
+    switch (flags & IMM_MASK) {
+    case IB:
+        out->imm_size = 1;
+        break;
+    case IW:
+        out->imm_size = 2;
+        break;
+    case IZ:
+        out->imm_size = out->opsize && !rexw ? 2 : 4;
+        break;
+    case IV:
+        out->imm_size = rexw ? 8 : out->opsize ? 2 : 4;
+        break;
+    case IWB:
+        out->imm_size = 3;
+        break;
+    case MO:
+        out->imm_size = out->addrsize ? 4 : 8;
+        break;
+    case G3:
+        if (((out->modrm >> 3) & 7) <= 1) {
+            out->imm_size = out->opcode == 0xf6 ? 1 : out->opsize && !rexw ? 2 : 4;
+        }
+        break;
+    default:
+        break;
+    }
+    out->relative_branch = (flags & R) != 0;
+
+    if ((size_t) (end - p) < out->imm_size) {
+        return 0;
+    }
+    out->length = p + out->imm_size - inst;
+    return out->length;
+}
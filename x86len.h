@@ -0,0 +1,63 @@
+/*
+ * Copyright 2018 Andrew Gaul <andrew@gaul.org>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __X86LEN_H__
+#define __X86LEN_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum x86_encoding {
+    X86_ENCODING_LEGACY,
+    X86_ENCODING_VEX2,
+    X86_ENCODING_VEX3,
+    X86_ENCODING_EVEX,
+};
+
+// Instruction boundaries and fields found by x86_length_decode.
+struct x86_length {
+    uint8_t length;
+    enum x86_encoding encoding;
+    // opcode map: 0 for one-byte opcodes, 1 for 0F, 2 for 0F38, 3 for 0F3A
+    uint8_t map;
+    uint8_t opcode;
+    // offset of the opcode byte
+    uint8_t opcode_offset;
+    // zero if there is no REX prefix
+    uint8_t rex;
+    bool has_modrm;
+    uint8_t modrm;
+    // displacement and immediate sizes in bytes; both end the instruction
+    uint8_t disp_size;
+    uint8_t imm_size;
+    // displacement is relative to RIP
+    bool rip_relative;
+    // immediate is a branch displacement
+    bool relative_branch;
+    bool lock;
+    bool opsize;
+    bool addrsize;
+    bool rep;
+    bool repne;
+};
+
+// Decode the length of the 64-bit mode instruction at inst without XED.
+// Return the length or zero if the encoding is invalid, truncated, or not
+// handled, in which case the caller should fall back to xed_decode.
+size_t x86_length_decode(const uint8_t *inst, size_t len, struct x86_length *out);
+
+#endif
@@ -15,13 +15,24 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(X86LINT_STATS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+#include "x86len.h"
+#include "x86lint.h"
 #include "xed/xed-interface.h"
 
-// TODO: handle 10-15 byte NOPs
+// NOPs of 10-15 bytes repeat 66 or segment prefixes, which some decoders
+// handle slowly, so padding of 10 or more bytes may use a 9-byte NOP followed
+// by another.  See padding.c for how much padding a binary contains.
 bool check_suboptimal_nops(const uint8_t *inst, size_t len)
 {
     int prev_nop = 0;
@@ -504,45 +515,669 @@ bool check_superfluous_lock_prefix(const xed_decoded_inst_t *xedd)
     }
 }
 
-static void dump_instruction(const xed_decoded_inst_t *xedd)
+static bool is_nop_iclass(const xed_decoded_inst_t *xedd)
+{
+    int iclass = xed_decoded_inst_get_iclass(xedd);
+    return iclass >= XED_ICLASS_NOP && iclass <= XED_ICLASS_NOP9;
+}
+
+bool check_oversized_branch(const xed_decoded_inst_t *xedd)
+{
+    xed_category_enum_t category = xed_decoded_inst_get_category(xedd);
+    if ((category != XED_CATEGORY_COND_BR && category != XED_CATEGORY_UNCOND_BR) ||
+        xed_decoded_inst_get_iclass(xedd) == XED_ICLASS_XBEGIN ||
+        xed_decoded_inst_get_branch_displacement_width(xedd) != 4) {
+        return true;
+    }
+
+    // rel8 JMP is 3 bytes shorter and rel8 Jcc 4, which moves the end of the
+    // instruction and thus the displacement origin closer to the target
+    int64_t disp = xed_decoded_inst_get_branch_displacement(xedd) + (category == XED_CATEGORY_UNCOND_BR ? 3 : 4);
+    return disp < INT8_MIN || disp > INT8_MAX;
+}
+
+// Return N, the factor EVEX scales disp8 by, which depends on the vector
+// length, element size and broadcast, or 1 for other encodings.
+static int64_t disp8_scale(const xed_decoded_inst_t *xedd)
+{
+    if (xed3_operand_get_vexvalid(xedd) != 2) {
+        return 1;
+    }
+    return xed3_operand_get_nelem(xedd) * xed3_operand_get_element_size(xedd) / 8;
+}
+
+bool check_oversized_displacement(const xed_decoded_inst_t *xedd)
+{
+    int64_t scale = disp8_scale(xedd);
+    // long NOPs use displacements as padding
+    if (is_nop_iclass(xedd) || scale == 0) {
+        return true;
+    }
+
+    for (int i = 0; i < xed_decoded_inst_number_of_memory_operands(xedd); ++i) {
+        xed_reg_enum_t base = xed_decoded_inst_get_base_reg(xedd, i);
+        // absolute and RIP-relative addresses only have a disp32 form
+        if (base == XED_REG_INVALID || base == XED_REG_RIP || base == XED_REG_EIP ||
+            xed_decoded_inst_get_memory_displacement_width(xedd, i) != 4) {
+            continue;
+        }
+        int64_t disp = xed_decoded_inst_get_memory_displacement(xedd, i);
+        if (disp % scale == 0 && disp / scale >= INT8_MIN && disp / scale <= INT8_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool needs_displacement(xed_reg_enum_t base)
+{
+    return base == XED_REG_RBP || base == XED_REG_R13 || base == XED_REG_EBP || base == XED_REG_R13D;
+}
+
+bool check_redundant_displacement(const xed_decoded_inst_t *xedd)
+{
+    if (is_nop_iclass(xedd)) {
+        return true;
+    }
+
+    for (int i = 0; i < xed_decoded_inst_number_of_memory_operands(xedd); ++i) {
+        if (xed_decoded_inst_get_memory_displacement_width(xedd, i) != 1 ||
+            xed_decoded_inst_get_memory_displacement(xedd, i) != 0) {
+            continue;
+        }
+        // only RBP and R13 bases require a displacement
+        if (!needs_displacement(xed_decoded_inst_get_base_reg(xedd, i))) {
+            return false;
+        }
+        // [RBP+REG*1+0] can swap base and index to encode as [REG+RBP]
+        xed_reg_enum_t index = xed_decoded_inst_get_index_reg(xedd, i);
+        if (index != XED_REG_INVALID && xed_reg_class(index) == XED_REG_CLASS_GPR &&
+            xed_decoded_inst_get_scale(xedd, i) == 1 && !needs_displacement(index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_vex_register(xed_reg_enum_t reg)
+{
+    return (reg >= XED_REG_XMM0 && reg <= XED_REG_XMM15) || (reg >= XED_REG_YMM0 && reg <= XED_REG_YMM15);
+}
+
+static bool is_low_vector_register(xed_reg_enum_t reg)
+{
+    return (reg >= XED_REG_XMM0 && reg <= XED_REG_XMM7) || (reg >= XED_REG_YMM0 && reg <= XED_REG_YMM7);
+}
+
+// Return true if ModRM.rm can move into a field VEX2 can extend.  Moves have
+// a second form with reg and rm exchanged and commutative operations can
+// exchange rm with VEX.vvvv.
+static bool can_swap_rm(const xed_decoded_inst_t *xedd)
+{
+    if (xed3_operand_get_mod(xedd) != 3) {
+        return false;
+    }
+
+    switch (xed_decoded_inst_get_iclass(xedd)) {
+    case XED_ICLASS_VMOVAPD: case XED_ICLASS_VMOVAPS:
+    case XED_ICLASS_VMOVDQA: case XED_ICLASS_VMOVDQU:
+    case XED_ICLASS_VMOVUPD: case XED_ICLASS_VMOVUPS:
+        return !xed3_operand_get_rexr(xedd);
+    // floating-point ADD and MUL pick which NaN to return by operand order
+    case XED_ICLASS_VANDPD: case XED_ICLASS_VANDPS:
+    case XED_ICLASS_VORPD: case XED_ICLASS_VORPS:
+    case XED_ICLASS_VXORPD: case XED_ICLASS_VXORPS:
+    case XED_ICLASS_VPADDB: case XED_ICLASS_VPADDW: case XED_ICLASS_VPADDD: case XED_ICLASS_VPADDQ:
+    case XED_ICLASS_VPAND: case XED_ICLASS_VPOR: case XED_ICLASS_VPXOR:
+    case XED_ICLASS_VPCMPEQB: case XED_ICLASS_VPCMPEQW: case XED_ICLASS_VPCMPEQD:
+    case XED_ICLASS_VPMULLW: case XED_ICLASS_VPMULUDQ:
+        return is_low_vector_register(xed_decoded_inst_get_reg(xedd, XED_OPERAND_REG1));
+    default:
+        return false;
+    }
+}
+
+bool check_oversized_vex(const xed_decoded_inst_t *xedd)
+{
+    // VEX2 implies the 0F map, W0 and no X or B extension
+    if (xed3_operand_get_vexvalid(xedd) != 1 || !xed3_operand_get_vex_c4(xedd) ||
+        xed3_operand_get_map(xedd) != 1 || xed3_operand_get_rexw(xedd)) {
+        return true;
+    }
+    if (!xed3_operand_get_rexx(xedd) && !xed3_operand_get_rexb(xedd)) {
+        return false;
+    }
+    return !can_swap_rm(xedd);
+}
+
+// a 2-byte VEX prefix is always one byte shorter
+static size_t vex_bytes_saved(const xed_decoded_inst_t *xedd)
+{
+    return 1;
+}
+
+// longest operand shape iform_shape writes
+#define MAX_SHAPE 64
+
+// Write the kinds of the operands an iform name lists, e.g., "XMM GPR32 " for
+// VPBROADCASTD_XMMu32_MASKmskw_GPR32u32_AVX512.  Masks, element types and
+// suffixes such as AVX512 or VL128 are dropped, so that the VEX and EVEX forms
+// of an operation on the same operands have the same shape.
+static void iform_shape(xed_iform_enum_t iform, char *shape, size_t size)
+{
+    const char *name = strchr(xed_iform_enum_t2str(iform), '_');
+    size_t n = 0;
+
+    shape[0] = '\0';
+    while (name != NULL) {
+        const char *token = name + 1;
+        size_t len = 0;
+        while (isupper((unsigned char) token[len])) {
+            ++len;
+        }
+        bool kind = len == 3 && (strncmp(token, "XMM", 3) == 0 || strncmp(token, "YMM", 3) == 0 ||
+                                 strncmp(token, "MEM", 3) == 0 || strncmp(token, "IMM", 3) == 0);
+        // GPR32 and GPR64 differ
+        if (len == 3 && strncmp(token, "GPR", 3) == 0) {
+            while (isdigit((unsigned char) token[len])) {
+                ++len;
+            }
+            kind = true;
+        }
+        if (kind && n + len + 1 < size) {
+            memcpy(shape + n, token, len);
+            n += len;
+            shape[n++] = ' ';
+            shape[n] = '\0';
+        }
+        name = strchr(token, '_');
+    }
+}
+
+// Return true if an AVX, AVX2, F16C or FMA form of an EVEX instruction takes
+// the same operands.  Some iclasses have VEX forms for only some operands,
+// e.g., VPBROADCASTD from a GPR and VPERMQ with a vector index are AVX-512
+// only.  EVEX-only instructions with a VEX equivalent under another name are
+// listed explicitly.
+static bool has_vex_form(const xed_decoded_inst_t *xedd)
+{
+    xed_iclass_enum_t iclass = xed_decoded_inst_get_iclass(xedd);
+
+    switch (iclass) {
+    case XED_ICLASS_VMOVDQA32: case XED_ICLASS_VMOVDQA64:
+    case XED_ICLASS_VMOVDQU8: case XED_ICLASS_VMOVDQU16:
+    case XED_ICLASS_VMOVDQU32: case XED_ICLASS_VMOVDQU64:
+    case XED_ICLASS_VPANDD: case XED_ICLASS_VPANDQ:
+    case XED_ICLASS_VPANDND: case XED_ICLASS_VPANDNQ:
+    case XED_ICLASS_VPORD: case XED_ICLASS_VPORQ:
+    case XED_ICLASS_VPXORD: case XED_ICLASS_VPXORQ:
+        return true;
+    default:
+        break;
+    }
+
+    char shape[MAX_SHAPE];
+    char vex_shape[MAX_SHAPE];
+    iform_shape(xed_decoded_inst_get_iform_enum(xedd), shape, sizeof(shape));
+
+    xed_uint32_t first = xed_iform_first_per_iclass(iclass);
+    for (xed_uint32_t i = 0; i < xed_iform_max_per_iclass(iclass); ++i) {
+        xed_iform_enum_t iform = (xed_iform_enum_t) (first + i);
+        switch (xed_iform_to_extension(iform)) {
+        case XED_EXTENSION_AVX:
+        case XED_EXTENSION_AVX2:
+        case XED_EXTENSION_F16C:
+        case XED_EXTENSION_FMA:
+            iform_shape(iform, vex_shape, sizeof(vex_shape));
+            if (strcmp(shape, vex_shape) == 0) {
+                return true;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+// Return true if VEX.W selects a 64-bit general-purpose operand of a 0F map
+// instruction, as for VMOVQ to and from a GPR, VCVTSI2SS/SD and
+// VCVT(T)SS/SD2SI.  Other 0F map instructions ignore VEX.W, while EVEX uses it
+// for the element size.
+static bool vex_w_significant(const xed_decoded_inst_t *xedd)
+{
+    switch (xed_decoded_inst_get_nominal_opcode(xedd)) {
+    case 0x2a: case 0x2c: case 0x2d: case 0x6e:
+        return true;
+    case 0x7e:
+        // 66 0F 7E moves to a GPR or memory; F3 0F 7E is VMOVQ xmm, xmm/m64
+        return xed3_operand_get_vex_prefix(xedd) == 1;
+    default:
+        return false;
+    }
+}
+
+size_t evex_bytes_saved(const xed_decoded_inst_t *xedd)
+{
+    if (xed3_operand_get_vexvalid(xedd) != 2 || xed3_operand_get_mask(xedd) != 0 ||
+        xed3_operand_get_zeroing(xedd) || xed3_operand_get_bcrc(xedd) || xed3_operand_get_vl(xedd) > 1 ||
+        !has_vex_form(xedd)) {
+        return 0;
+    }
+
+    const xed_inst_t *xi = xed_decoded_inst_inst(xedd);
+    for (unsigned i = 0; i < xed_inst_noperands(xi); ++i) {
+        const xed_operand_t *op = xed_inst_operand(xi, i);
+        xed_operand_enum_t name = xed_operand_name(op);
+        if (!xed_operand_is_register(name)) {
+            continue;
+        }
+        xed_reg_enum_t reg = xed_decoded_inst_get_reg(xedd, name);
+        switch (xed_reg_class(reg)) {
+        case XED_REG_CLASS_XMM:
+        case XED_REG_CLASS_YMM:
+            if (!is_vex_register(reg)) {
+                return 0;
+            }
+            break;
+        case XED_REG_CLASS_ZMM:
+            return 0;
+        case XED_REG_CLASS_MASK:
+            // K0 as the write mask means no masking, but mask destinations
+            // and sources have no VEX equivalent
+            if (reg != XED_REG_K0 || xed_operand_nonterminal_name(op) != XED_NONTERMINAL_MASK1) {
+                return 0;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // EVEX scales disp8 by the operand size and VEX would need disp32
+    for (int i = 0; i < xed_decoded_inst_number_of_memory_operands(xedd); ++i) {
+        int64_t disp = xed_decoded_inst_get_memory_displacement(xedd, i);
+        if (xed_decoded_inst_get_memory_displacement_width(xedd, i) == 1 && (disp < INT8_MIN || disp > INT8_MAX)) {
+            return 0;
+        }
+    }
+
+    bool vex2 = xed3_operand_get_map(xedd) == 1 && !xed3_operand_get_rexx(xedd) && !xed3_operand_get_rexb(xedd) &&
+                !(xed3_operand_get_rexw(xedd) && vex_w_significant(xedd));
+    return vex2 ? 2 : 1;
+}
+
+bool check_oversized_evex(const xed_decoded_inst_t *xedd)
+{
+    return evex_bytes_saved(xedd) == 0;
+}
+
+static void dump_instruction(FILE *out, const xed_decoded_inst_t *xedd)
 {
     char buf[1024];
     xed_decoded_inst_dump(xedd, buf, sizeof(buf));
-    printf("%s\n", buf);
+    fprintf(out, "%s\n", buf);
 }
 
-static void dump_machine_code(const xed_decoded_inst_t *xedd, const uint8_t *inst)
+static void dump_machine_code(FILE *out, const xed_decoded_inst_t *xedd, const uint8_t *inst)
 {
     int i;
     int len = xed_decoded_inst_get_length(xedd);
     for (i = 0; i < len; ++i) {
-        printf("%02x ", inst[i]);
+        fprintf(out, "%02x ", inst[i]);
     }
-    printf("\n");
+    fprintf(out, "\n");
 }
 
-int check_instructions(const uint8_t *inst, size_t len)
+static const struct rule_info {
+    const char *name;
+    const char *message;
+    bool (*check)(const xed_decoded_inst_t *xedd);
+    // rule inspects immediate or displacement values which relocations may patch
+    bool uses_fields;
+    // bytes a flagged instruction could save, if the rule prints them
+    size_t (*bytes_saved)(const xed_decoded_inst_t *xedd);
+} rules[X86LINT_RULE_COUNT] = {
+    // check_suboptimal_nops examines the following instructions and is called separately
+    [X86LINT_RULE_SUBOPTIMAL_NOPS] = { "suboptimal_nops", "suboptimal nops", NULL, false },
+    [X86LINT_RULE_OVERSIZED_IMMEDIATE] = { "oversized_immediate", "oversized immediate", check_oversized_immediate, true },
+    [X86LINT_RULE_OVERSIZED_ADD128] = { "oversized_add128", "oversized ADD 128", check_oversized_add128, true },
+    [X86LINT_RULE_UNNEEDED_REX] = { "unneeded_rex", "unneeded REX prefix", check_unneeded_rex, false },
+    [X86LINT_RULE_CMP_ZERO] = { "cmp_zero", "suboptimal compare register", check_cmp_zero, true },
+    // TODO: check_mov_zero disabled due to false positives from CMOV sequences.  See #7.
+    [X86LINT_RULE_IMPLICIT_REGISTER] = { "implicit_register", "unneeded explicit register", check_implicit_register, false },
+    [X86LINT_RULE_IMPLICIT_IMMEDIATE] = { "implicit_immediate", "unneeded explicit immediate", check_implicit_immediate, true },
+    [X86LINT_RULE_AND_STRENGTH_REDUCE] = { "and_strength_reduce", "unneeded AND immediate", check_and_strength_reduce, true },
+    [X86LINT_RULE_MISSING_LOCK_PREFIX] = { "missing_lock_prefix", "expected lock prefix", check_missing_lock_prefix, false },
+    [X86LINT_RULE_SUPERFLUOUS_LOCK_PREFIX] = { "superfluous_lock_prefix", "superfluous lock prefix", check_superfluous_lock_prefix, false },
+    [X86LINT_RULE_OVERSIZED_BRANCH] = { "oversized_branch", "oversized branch displacement", check_oversized_branch, true },
+    [X86LINT_RULE_OVERSIZED_DISPLACEMENT] = { "oversized_displacement", "oversized displacement", check_oversized_displacement, true },
+    [X86LINT_RULE_REDUNDANT_DISPLACEMENT] = { "redundant_displacement", "redundant displacement", check_redundant_displacement, true },
+    [X86LINT_RULE_OVERSIZED_VEX] = { "oversized_vex", "oversized VEX prefix", check_oversized_vex, false, vex_bytes_saved },
+    [X86LINT_RULE_OVERSIZED_EVEX] = { "oversized_evex", "oversized EVEX prefix", check_oversized_evex, false, evex_bytes_saved },
+};
+
+const char *x86lint_rule_name(enum x86lint_rule rule)
+{
+    return rules[rule].name;
+}
+
+// Return true if some rule may flag the instruction.  Other instructions are
+// only length decoded.  This must remain a superset of what the rules check.
+static bool is_candidate(const uint8_t *inst, const struct x86_length *fast)
+{
+    // check_unneeded_rex
+    if (fast->rex != 0) {
+        return true;
+    }
+    // check_oversized_branch
+    if (fast->relative_branch && fast->imm_size == 4) {
+        return true;
+    }
+    // check_oversized_displacement and check_redundant_displacement
+    const uint8_t *disp = inst + fast->length - fast->imm_size - fast->disp_size;
+    if (fast->disp_size == 1 && disp[0] == 0) {
+        return true;
+    }
+    if (fast->disp_size == 4 && (fast->modrm >> 6) == 2) {
+        int32_t value;
+        memcpy(&value, disp, sizeof(value));
+        if (value >= INT8_MIN && value <= INT8_MAX) {
+            return true;
+        }
+    }
+    // check_oversized_vex and check_oversized_evex
+    if (fast->encoding == X86_ENCODING_VEX3 || fast->encoding == X86_ENCODING_EVEX) {
+        return true;
+    }
+    if (fast->encoding != X86_ENCODING_LEGACY) {
+        return false;
+    }
+
+    if (fast->map == 0) {
+        switch (fast->opcode) {
+        // ALU with accumulator and immediate
+        case 0x05: case 0x0d: case 0x15: case 0x1d:
+        case 0x24: case 0x25: case 0x2d: case 0x35: case 0x3c: case 0x3d:
+        // IMUL with immediate
+        case 0x69: case 0x6b:
+        // ALU with immediate
+        case 0x80: case 0x81: case 0x83:
+        // XCHG
+        case 0x86: case 0x87:
+        // NOP and XCHG with accumulator
+        case 0x90: case 0x91: case 0x92: case 0x93:
+        case 0x94: case 0x95: case 0x96: case 0x97:
+        // MOV with immediate
+        case 0xb8: case 0xb9: case 0xba: case 0xbb:
+        case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+        case 0xc7:
+        // shift and rotate with immediate
+        case 0xc1:
+        // LEAVE
+        case 0xc9:
+        // TEST with immediate
+        case 0xf6: case 0xf7:
+            return true;
+        default:
+            return false;
+        }
+    } else if (fast->map == 1) {
+        switch (fast->opcode) {
+        // multi-byte NOPs and hints
+        case 0x0d:
+        case 0x18: case 0x19: case 0x1a: case 0x1b:
+        case 0x1c: case 0x1d: case 0x1e: case 0x1f:
+        // CMPXCHG, XADD, CMPXCHG8B and CMPXCHG16B
+        case 0xb0: case 0xb1: case 0xc0: case 0xc1: case 0xc7:
+            return true;
+        default:
+            return false;
+        }
+    }
+    return false;
+}
+
+#ifdef X86LINT_STATS
+
+_Thread_local struct x86lint_stats x86lint_stats;
+
+// Raw timestamps are TSC ticks on x86 which cost a few nanoseconds to read.
+// They are converted to nanoseconds only when printing.
+static uint64_t stats_base_ticks;
+static struct timespec stats_base_time;
+
+uint64_t x86lint_stats_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void x86lint_stats_reset(void)
+{
+    memset(&x86lint_stats, 0, sizeof(x86lint_stats));
+    clock_gettime(CLOCK_MONOTONIC, &stats_base_time);
+    stats_base_ticks = x86lint_stats_ticks();
+}
+
+void x86lint_stats_merge(const struct x86lint_stats *src)
+{
+    x86lint_stats.bytes += src->bytes;
+    x86lint_stats.instructions += src->instructions;
+    x86lint_stats.fast_instructions += src->fast_instructions;
+    x86lint_stats.parse_ticks += src->parse_ticks;
+    x86lint_stats.decode_ticks += src->decode_ticks;
+    x86lint_stats.output_ticks += src->output_ticks;
+    for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+        x86lint_stats.rules[rule].evaluations += src->rules[rule].evaluations;
+        x86lint_stats.rules[rule].hits += src->rules[rule].hits;
+        x86lint_stats.rules[rule].ticks += src->rules[rule].ticks;
+    }
+}
+
+static double stats_ns_per_tick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ticks = x86lint_stats_ticks() - stats_base_ticks;
+    double ns = (double) (now.tv_sec - stats_base_time.tv_sec) * 1e9 +
+        (double) (now.tv_nsec - stats_base_time.tv_nsec);
+    if (ticks == 0) {
+        return 0;
+    }
+    return ns / (double) ticks;
+}
+
+static void print_prometheus_counter(FILE *out, const char *name, const char *help, double value)
+{
+    fprintf(out, "# HELP x86lint_%s %s\n", name, help);
+    fprintf(out, "# TYPE x86lint_%s counter\n", name);
+    fprintf(out, "x86lint_%s %.17g\n", name, value);
+}
+
+static void print_prometheus_rule_counter(FILE *out, const char *name, const char *help,
+                                          const double *values)
+{
+    fprintf(out, "# HELP x86lint_%s %s\n", name, help);
+    fprintf(out, "# TYPE x86lint_%s counter\n", name);
+    for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+        fprintf(out, "x86lint_%s{rule=\"%s\"} %.17g\n", name, rules[rule].name, values[rule]);
+    }
+}
+
+void x86lint_stats_print(FILE *out, enum x86lint_stats_format format)
+{
+    const struct x86lint_stats *stats = &x86lint_stats;
+    double scale = stats_ns_per_tick();
+
+    switch (format) {
+    case X86LINT_STATS_JSON:
+        fprintf(out, "{\"bytes\": %" PRIu64 ", \"instructions\": %" PRIu64
+                ", \"fast_instructions\": %" PRIu64
+                ", \"parse_ns\": %.0f, \"decode_ns\": %.0f, \"output_ns\": %.0f, \"rules\": {",
+                stats->bytes, stats->instructions, stats->fast_instructions, stats->parse_ticks * scale,
+                stats->decode_ticks * scale, stats->output_ticks * scale);
+        for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+            const struct x86lint_rule_stats *r = &stats->rules[rule];
+            fprintf(out, "%s\"%s\": {\"evaluations\": %" PRIu64 ", \"hits\": %" PRIu64 ", \"ns\": %.0f}",
+                    rule == 0 ? "" : ", ", rules[rule].name, r->evaluations, r->hits,
+                    r->ticks * scale);
+        }
+        fprintf(out, "}}\n");
+        break;
+    case X86LINT_STATS_PROMETHEUS: {
+        double values[X86LINT_RULE_COUNT];
+        print_prometheus_counter(out, "bytes_total", "Bytes of machine code scanned.",
+                                 stats->bytes);
+        print_prometheus_counter(out, "instructions_total", "Instructions decoded.",
+                                 stats->instructions);
+        print_prometheus_counter(out, "fast_instructions_total",
+                                 "Instructions only length decoded, skipping XED.",
+                                 stats->fast_instructions);
+        print_prometheus_counter(out, "parse_seconds_total", "Time spent parsing input files.",
+                                 stats->parse_ticks * scale / 1e9);
+        print_prometheus_counter(out, "decode_seconds_total", "Time spent in xed_decode.",
+                                 stats->decode_ticks * scale / 1e9);
+        print_prometheus_counter(out, "output_seconds_total", "Time spent formatting findings.",
+                                 stats->output_ticks * scale / 1e9);
+        for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+            values[rule] = stats->rules[rule].evaluations;
+        }
+        print_prometheus_rule_counter(out, "rule_evaluations_total", "Rule evaluations.", values);
+        for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+            values[rule] = stats->rules[rule].hits;
+        }
+        print_prometheus_rule_counter(out, "rule_hits_total", "Rule findings.", values);
+        for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+            values[rule] = stats->rules[rule].ticks * scale / 1e9;
+        }
+        print_prometheus_rule_counter(out, "rule_seconds_total", "Time spent evaluating rules.", values);
+        break;
+    }
+    default:
+        abort();
+    }
+}
+
+#define STATS_RULE(rule, hit, start) \
+do { \
+    struct x86lint_rule_stats *r = &x86lint_stats.rules[rule]; \
+    r->ticks += x86lint_stats_ticks() - (start); \
+    r->evaluations += 1; \
+    r->hits += !(hit); \
+} while (0)
+
+#else
+
+#define STATS_RULE(rule, hit, start) do {} while (0)
+
+#endif
+
+static void report(FILE *out, const struct x86lint_options *options, const char *message, size_t offset)
+{
+    if (options == NULL) {
+        fprintf(out, "%s at offset: %zu\n", message, offset);
+    } else {
+        fprintf(out, "%s at address: 0x%" PRIx64 "\n", message, options->address + offset);
+    }
+}
+
+// return true if a relocation patches any byte in [offset, offset + len)
+static bool is_relocated(const struct x86lint_options *options, size_t offset, size_t len)
+{
+    if (options == NULL || options->nrelocations == 0) {
+        return false;
+    }
+    size_t lo = 0;
+    size_t hi = options->nrelocations;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (options->relocations[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < options->nrelocations && options->relocations[lo] < offset + len;
+}
+
+int check_instructions_with(const uint8_t *inst, size_t len, const struct x86lint_options *options)
 {
     int errors = 0;
+    FILE *out = options != NULL && options->out != NULL ? options->out : stdout;
+    bool quiet = options != NULL && options->quiet && options->on_finding != NULL;
+    bool validate = options != NULL && options->validate_length;
     xed_machine_mode_enum_t mmode = XED_MACHINE_MODE_LONG_64;
     xed_address_width_enum_t stack_addr_width = XED_ADDRESS_WIDTH_64b;
 
+    X86LINT_STATS_ADD(bytes, len);
+
     for (size_t offset = 0; offset < len;) {
+        struct x86_length fast;
+        X86LINT_STATS_START(length_start);
+        size_t fast_len = x86_length_decode(inst + offset, len - offset, &fast);
+        X86LINT_STATS_ELAPSED(decode_ticks, length_start);
+        bool skip = fast_len != 0 && !is_candidate(inst + offset, &fast);
+        if (skip && !validate) {
+            X86LINT_STATS_ADD(instructions, 1);
+            X86LINT_STATS_ADD(fast_instructions, 1);
+            offset += fast_len;
+            continue;
+        }
+
         xed_decoded_inst_t xedd;
+        X86LINT_STATS_START(decode_start);
         xed_decoded_inst_zero(&xedd);
         xed_decoded_inst_set_mode(&xedd, mmode, stack_addr_width);
 
         xed_error_enum_t err = xed_decode(&xedd, inst + offset, len - offset);
+        X86LINT_STATS_ELAPSED(decode_ticks, decode_start);
+        if (validate && fast_len != 0 &&
+            (err != XED_ERROR_NONE || fast_len != xed_decoded_inst_get_length(&xedd))) {
+            report(out, options, "length decoder mismatch", offset);
+            fprintf(out, "length decoder: %zu bytes, XED: %s, %u bytes\n\n", fast_len,
+                    xed_error_enum_t2str(err), err == XED_ERROR_NONE ? xed_decoded_inst_get_length(&xedd) : 0);
+            ++errors;
+        }
+        if (err == XED_ERROR_BUFFER_TOO_SHORT && options != NULL && options->consumed != NULL) {
+            *options->consumed = offset;
+            return errors;
+        }
         if (err != XED_ERROR_NONE) {
-            printf("Decoding error at offset: %zu: %s\n", offset, xed_error_enum_t2str(err));
+            if (options != NULL && options->resync) {
+                ++offset;
+                continue;
+            }
+            if (options == NULL) {
+                fprintf(out, "Decoding error at offset: %zu: %s\n", offset, xed_error_enum_t2str(err));
+            } else if (!options->quiet) {
+                fprintf(out, "Decoding error at address: 0x%" PRIx64 ": %s\n",
+                        options->address + offset, xed_error_enum_t2str(err));
+            }
             return -1;
         }
+        if (options != NULL && offset < options->lead) {
+            offset += xed_decoded_inst_get_length(&xedd);
+            continue;
+        }
+        X86LINT_STATS_ADD(instructions, 1);
 
+        X86LINT_STATS_START(nops_start);
         bool result = check_suboptimal_nops(inst + offset, len - offset);
-        if (!result) {
-            printf("suboptimal nops at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
+        STATS_RULE(X86LINT_RULE_SUBOPTIMAL_NOPS, result, nops_start);
+        if (!result && quiet) {
+            options->on_finding(options->arg, X86LINT_RULE_SUBOPTIMAL_NOPS, options->address + offset);
+            ++errors;
+        } else if (!result) {
+            X86LINT_STATS_START(output_start);
+            report(out, options, rules[X86LINT_RULE_SUBOPTIMAL_NOPS].message, offset);
+            dump_instruction(out, &xedd);
+            dump_machine_code(out, &xedd, inst + offset);
 
             xed_decoded_inst_t xedd2;
             xed_decoded_inst_zero(&xedd2);
@@ -550,107 +1185,169 @@ int check_instructions(const uint8_t *inst, size_t len)
 
             size_t len2 = xed_decoded_inst_get_length(&xedd);
             xed_decode(&xedd2, inst + offset + len2, len - offset - len2);
-            dump_instruction(&xedd2);
-            dump_machine_code(&xedd2, inst + offset + len2);
-            printf("\n");
+            dump_instruction(out, &xedd2);
+            dump_machine_code(out, &xedd2, inst + offset + len2);
+            if (options != NULL && options->on_finding != NULL) {
+                options->on_finding(options->arg, X86LINT_RULE_SUBOPTIMAL_NOPS, options->address + offset);
+            }
+            if (validate && skip) {
+                fprintf(out, "length decoder prefilter would skip this instruction\n");
+            }
+            fprintf(out, "\n");
+            X86LINT_STATS_ELAPSED(output_ticks, output_start);
             ++errors;
         }
 
-        result = check_oversized_immediate(&xedd);
-        if (!result) {
-            printf("oversized immediate at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
+        bool relocated = is_relocated(options, offset, xed_decoded_inst_get_length(&xedd));
+        for (int rule = 0; rule < X86LINT_RULE_COUNT; ++rule) {
+            if (rules[rule].check == NULL || (relocated && rules[rule].uses_fields)) {
+                continue;
+            }
+            X86LINT_STATS_START(rule_start);
+            result = rules[rule].check(&xedd);
+            STATS_RULE(rule, result, rule_start);
+            if (!result && quiet) {
+                options->on_finding(options->arg, rule, options->address + offset);
+                ++errors;
+            } else if (!result) {
+                X86LINT_STATS_START(output_start);
+                report(out, options, rules[rule].message, offset);
+                dump_instruction(out, &xedd);
+                dump_machine_code(out, &xedd, inst + offset);
+                if (rules[rule].bytes_saved != NULL) {
+                    fprintf(out, "%zu bytes shorter\n", rules[rule].bytes_saved(&xedd));
+                }
+                if (options != NULL && options->on_finding != NULL) {
+                    options->on_finding(options->arg, rule, options->address + offset);
+                }
+                if (validate && skip) {
+                    fprintf(out, "length decoder prefilter would skip this instruction\n");
+                }
+                fprintf(out, "\n");
+                X86LINT_STATS_ELAPSED(output_ticks, output_start);
+                ++errors;
+            }
         }
 
-        result = check_oversized_add128(&xedd);
-        if (!result) {
-            printf("oversized ADD 128 at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
-        }
+        offset += xed_decoded_inst_get_length(&xedd);
+    }
 
-        result = check_unneeded_rex(&xedd);
-        if (!result) {
-            printf("unneeded REX prefix at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
-        }
+    if (options != NULL && options->consumed != NULL) {
+        *options->consumed = len;
+    }
+    return errors;
+}
 
-        result = check_cmp_zero(&xedd);
-        if (!result) {
-            printf("suboptimal compare register at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
-        }
+int check_instructions(const uint8_t *inst, size_t len)
+{
+    return check_instructions_with(inst, len, NULL);
+}
 
-        // TODO: Disabled due to false positives from CMOV sequences.  See #7.
-        /*
-        result = check_mov_zero(&xedd);
-        if (!result) {
-            printf("suboptimal zero register at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
+// JMP or Jcc considered by relax_branches
+struct relax_branch {
+    int64_t offset;
+    int64_t target;
+    uint8_t length;
+    uint8_t short_length;
+    uint8_t near_length;
+    uint8_t size;
+};
+
+// return the index of the first branch at or after offset
+static size_t lower_bound_branch(const struct relax_branch *branches, size_t count, int64_t offset)
+{
+    size_t lo = 0;
+    size_t hi = count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (branches[mid].offset < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
-        */
+    }
+    return lo;
+}
 
-        result = check_implicit_register(&xedd);
-        if (!result) {
-            printf("unneeded explicit register at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
-        }
+size_t relax_branches(const uint8_t *inst, size_t len)
+{
+    struct relax_branch *branches = NULL;
+    size_t count = 0;
+    size_t capacity = 0;
 
-        result = check_implicit_immediate(&xedd);
-        if (!result) {
-            printf("unneeded explicit immediate at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
+    for (size_t offset = 0; offset < len;) {
+        struct x86_length fast;
+        size_t length = x86_length_decode(inst + offset, len - offset, &fast);
+        if (length == 0) {
+            xed_decoded_inst_t xedd;
+            xed_decoded_inst_zero(&xedd);
+            xed_decoded_inst_set_mode(&xedd, XED_MACHINE_MODE_LONG_64, XED_ADDRESS_WIDTH_64b);
+            length = xed_decode(&xedd, inst + offset, len - offset) == XED_ERROR_NONE ?
+                     xed_decoded_inst_get_length(&xedd) : 1;
+            offset += length;
+            continue;
         }
 
-        result = check_and_strength_reduce(&xedd);
-        if (!result) {
-            printf("unneeded AND immediate at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
+        // rel8 forms save 3 bytes for JMP and 4 for Jcc
+        int grow = 0;
+        if (fast.encoding == X86_ENCODING_LEGACY && fast.map == 0 &&
+            (fast.opcode == 0xeb || (fast.opcode >= 0x70 && fast.opcode <= 0x7f))) {
+            grow = fast.opcode == 0xeb ? 3 : 4;
+        } else if (fast.encoding == X86_ENCODING_LEGACY && fast.map == 0 && fast.opcode == 0xe9) {
+            grow = -3;
+        } else if (fast.encoding == X86_ENCODING_LEGACY && fast.map == 1 && fast.opcode >= 0x80 && fast.opcode <= 0x8f) {
+            grow = -4;
         }
-
-        result = check_missing_lock_prefix(&xedd);
-        if (!result) {
-            printf("expected lock prefix at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
+        if (grow != 0) {
+            const uint8_t *imm = inst + offset + length - fast.imm_size;
+            int32_t disp = (int8_t) imm[0];
+            if (fast.imm_size == 4) {
+                memcpy(&disp, imm, sizeof(disp));
+            }
+            if (count == capacity) {
+                capacity = capacity == 0 ? 16 : capacity * 2;
+                branches = realloc(branches, capacity * sizeof(*branches));
+            }
+            struct relax_branch *branch = &branches[count++];
+            branch->offset = offset;
+            branch->target = (int64_t) (offset + length) + disp;
+            branch->length = length;
+            branch->short_length = grow > 0 ? length : length + grow;
+            branch->near_length = grow > 0 ? length + grow : length;
+            // start from all short and only grow branches which do not reach
+            branch->size = branch->short_length;
         }
+        offset += length;
+    }
 
-        result = check_superfluous_lock_prefix(&xedd);
-        if (!result) {
-            printf("superfluous lock prefix at offset: %zu\n", offset);
-            dump_instruction(&xedd);
-            dump_machine_code(&xedd, inst + offset);
-            printf("\n");
-            ++errors;
+    // bytes removed before each branch
+    int64_t *shrunk = malloc((count + 1) * sizeof(*shrunk));
+    for (bool changed = true; changed;) {
+        changed = false;
+        shrunk[0] = 0;
+        for (size_t i = 0; i < count; ++i) {
+            shrunk[i + 1] = shrunk[i] + branches[i].length - branches[i].size;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            struct relax_branch *branch = &branches[i];
+            if (branch->size == branch->near_length) {
+                continue;
+            }
+            int64_t target = branch->target;
+            if (target >= 0 && target < (int64_t) len) {
+                target -= shrunk[lower_bound_branch(branches, count, target)];
+            }
+            int64_t disp = target - (branch->offset - shrunk[i] + branch->size);
+            if (disp < INT8_MIN || disp > INT8_MAX) {
+                branch->size = branch->near_length;
+                changed = true;
+            }
         }
-
-        offset += xed_decoded_inst_get_length(&xedd);
     }
 
-    return errors;
+    int64_t saved = shrunk[count];
+    free(shrunk);
+    free(branches);
+    return saved;
 }
@@ -18,8 +18,33 @@
 #define __ASMLINT_H__
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include "xed/xed-interface.h"
 
+// rules evaluated by check_instructions
+enum x86lint_rule {
+    X86LINT_RULE_SUBOPTIMAL_NOPS,
+    X86LINT_RULE_OVERSIZED_IMMEDIATE,
+    X86LINT_RULE_OVERSIZED_ADD128,
+    X86LINT_RULE_UNNEEDED_REX,
+    X86LINT_RULE_CMP_ZERO,
+    X86LINT_RULE_IMPLICIT_REGISTER,
+    X86LINT_RULE_IMPLICIT_IMMEDIATE,
+    X86LINT_RULE_AND_STRENGTH_REDUCE,
+    X86LINT_RULE_MISSING_LOCK_PREFIX,
+    X86LINT_RULE_SUPERFLUOUS_LOCK_PREFIX,
+    X86LINT_RULE_OVERSIZED_BRANCH,
+    X86LINT_RULE_OVERSIZED_DISPLACEMENT,
+    X86LINT_RULE_REDUNDANT_DISPLACEMENT,
+    X86LINT_RULE_OVERSIZED_VEX,
+    X86LINT_RULE_OVERSIZED_EVEX,
+    X86LINT_RULE_COUNT,
+};
+
+// return the short name of a rule, e.g., "oversized_immediate"
+const char *x86lint_rule_name(enum x86lint_rule rule);
+
 // return false if instruction sequence contains multiple adjacent no ops
 bool check_suboptimal_nops(const uint8_t *inst, size_t len);
 
@@ -53,7 +78,121 @@ bool check_missing_lock_prefix(const xed_decoded_inst_t *xedd);
 // return false if instruction should not have a LOCK prefix
 bool check_superfluous_lock_prefix(const xed_decoded_inst_t *xedd);
 
+// return false if JMP or Jcc uses rel32 where rel8 reaches the target
+bool check_oversized_branch(const xed_decoded_inst_t *xedd);
+
+// return false if a memory operand uses disp32 where disp8, which EVEX scales by
+// the memory operand size, suffices
+bool check_oversized_displacement(const xed_decoded_inst_t *xedd);
+
+// return false if a memory operand encodes a zero disp8 it does not need
+bool check_redundant_displacement(const xed_decoded_inst_t *xedd);
+
+// return false if a 3-byte VEX prefix can be 2 bytes, possibly by swapping
+// operands
+bool check_oversized_vex(const xed_decoded_inst_t *xedd);
+
+// return false if an EVEX instruction uses no EVEX feature and has a shorter
+// VEX encoding
+bool check_oversized_evex(const xed_decoded_inst_t *xedd);
+
+// Return the bytes saved by encoding an EVEX instruction as VEX, or zero if it
+// masks, broadcasts, rounds, uses ZMM or registers 16-31, or has no VEX form.
+size_t evex_bytes_saved(const xed_decoded_inst_t *xedd);
+
+// Return the bytes saved by re-encoding every JMP and Jcc in a region of
+// linked code with the shortest displacement that reaches its target.
+// Shrinking one branch moves others, so sizes are relaxed to a fixed point.
+// Targets outside the region keep their addresses.
+size_t relax_branches(const uint8_t *inst, size_t len);
+
 // return number of failed checks
 int check_instructions(const uint8_t *inst, size_t len);
 
+struct x86lint_options {
+    // virtual address of the first instruction; findings are reported by address
+    uint64_t address;
+    // stream for findings; stdout if NULL
+    FILE *out;
+    // if true and on_finding is set, only call on_finding instead of printing
+    bool quiet;
+    // if non-NULL, called after printing each finding
+    void (*on_finding)(void *arg, enum x86lint_rule rule, uint64_t address);
+    void *arg;
+    // sorted offsets, relative to the first instruction, of fields patched by
+    // relocations; rules which inspect immediate or displacement values skip
+    // instructions containing them
+    const uint64_t *relocations;
+    size_t nrelocations;
+    // decode every instruction with XED and report where the length decoder
+    // disagrees or its prefilter would skip a finding
+    bool validate_length;
+    // on a decoding error skip one byte and continue instead of returning -1,
+    // for code which is interleaved with data or entered at an unknown boundary
+    bool resync;
+    // bytes at the start which are decoded but not checked, so that checking
+    // begins at an instruction boundary when inst starts at an unknown one
+    size_t lead;
+    // if non-NULL, stop at an instruction which runs past len instead of
+    // failing to decode it and store its offset, or len, for code read in
+    // windows whose last instruction continues in the next
+    size_t *consumed;
+};
+
+// return number of failed checks, reporting findings by address
+int check_instructions_with(const uint8_t *inst, size_t len, const struct x86lint_options *options);
+
+#ifdef X86LINT_STATS
+
+// Counters and timers collected by check_instructions when compiled with
+// -DX86LINT_STATS.  Times are in raw ticks; x86lint_stats_print converts them.
+struct x86lint_rule_stats {
+    uint64_t evaluations;
+    uint64_t hits;
+    uint64_t ticks;
+};
+
+struct x86lint_stats {
+    uint64_t bytes;
+    uint64_t instructions;
+    // instructions which no rule can flag, skipped after length decoding
+    uint64_t fast_instructions;
+    uint64_t parse_ticks;
+    uint64_t decode_ticks;
+    uint64_t output_ticks;
+    struct x86lint_rule_stats rules[X86LINT_RULE_COUNT];
+};
+
+enum x86lint_stats_format {
+    X86LINT_STATS_JSON,
+    X86LINT_STATS_PROMETHEUS,
+};
+
+// each thread collects its own counters; see x86lint_stats_merge
+extern _Thread_local struct x86lint_stats x86lint_stats;
+
+// return the current tick count
+uint64_t x86lint_stats_ticks(void);
+
+// zero all counters and start the clock used to convert ticks to nanoseconds
+void x86lint_stats_reset(void);
+
+// add counters from another thread to this thread's counters
+void x86lint_stats_merge(const struct x86lint_stats *src);
+
+// print counters as JSON or Prometheus text format
+void x86lint_stats_print(FILE *out, enum x86lint_stats_format format);
+
+#define X86LINT_STATS_START(var) uint64_t var = x86lint_stats_ticks()
+#define X86LINT_STATS_ADD(field, n) (x86lint_stats.field += (n))
+#define X86LINT_STATS_ELAPSED(field, start) (x86lint_stats.field += x86lint_stats_ticks() - (start))
+
+#else
+
+#define X86LINT_STATS_START(var) do {} while (0)
+#define X86LINT_STATS_ADD(field, n) do {} while (0)
+#define X86LINT_STATS_ELAPSED(field, start) do {} while (0)
+
+#endif
+
 #endif
@@ -16,7 +16,20 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "cfg.h"
+#include "diff.h"
+#include "dwarf.h"
+#include "elffile.h"
+#include "forwarding.h"
+#include "layout.h"
+#include "padding.h"
+#include "plt.h"
+#include "throughput.h"
+#include "uarch.h"
+#include "x86len.h"
 #include "x86lint.h"
 #include "xed/xed-interface.h"
 
@@ -28,6 +41,39 @@ do { \
     assert(func(&xedd)); \
 } while (0)
 
+#define CHECK_BYTES_SAVED(func, saved, ...) \
+do { \
+    static const uint8_t bytes[] = { __VA_ARGS__ }; \
+    xed_decoded_inst_t xedd; \
+    decode_instruction(&xedd, bytes, sizeof(bytes)); \
+    assert(func(&xedd) == (saved)); \
+} while (0)
+
+// run a check over the CFG of code at address and expect one finding with
+// message, or none if message is NULL
+#define CHECK_CFG(check, address, message, ...) \
+do { \
+    static const uint8_t bytes[] = { __VA_ARGS__ }; \
+    check_cfg(check, bytes, sizeof(bytes), address, message); \
+} while (0)
+
+#define CHECK_LENGTH(...) \
+do { \
+    static const uint8_t bytes[] = { __VA_ARGS__ }; \
+    xed_decoded_inst_t xedd; \
+    struct x86_length fast; \
+    decode_instruction(&xedd, bytes, sizeof(bytes)); \
+    assert(x86_length_decode(bytes, sizeof(bytes), &fast) == xed_decoded_inst_get_length(&xedd)); \
+} while (0)
+
+#define CHECK_NOP(expected, ...) \
+do { \
+    static const uint8_t bytes[] = { __VA_ARGS__ }; \
+    struct x86_length fast; \
+    assert(x86_length_decode(bytes, sizeof(bytes), &fast) == sizeof(bytes)); \
+    assert(is_nop(&fast) == (expected)); \
+} while (0)
+
 static void decode_instruction(xed_decoded_inst_t *xedd, const uint8_t *inst, size_t len)
 {
     xed_machine_mode_enum_t mmode = XED_MACHINE_MODE_LONG_64;
@@ -39,6 +85,54 @@ static void decode_instruction(xed_decoded_inst_t *xedd, const uint8_t *inst, si
     assert(err == XED_ERROR_NONE);
 }
 
+// Wrap a .debug_line section in a minimal linked ELF image.  The caller
+// frees the image.
+static uint8_t *debug_line_image(const uint8_t *line, size_t size, size_t *image_size)
+{
+    static const char shstrtab[] = "\0.shstrtab\0.debug_line";
+    size_t shoff = sizeof(Elf64_Ehdr);
+    size_t stroff = shoff + 3 * sizeof(Elf64_Shdr);
+    size_t lineoff = stroff + sizeof(shstrtab);
+    uint8_t *image = calloc(1, lineoff + size);
+
+    Elf64_Ehdr *ehdr = (Elf64_Ehdr *) image;
+    memcpy(ehdr->e_ident, ELFMAG, SELFMAG);
+    ehdr->e_ident[EI_CLASS] = ELFCLASS64;
+    ehdr->e_type = ET_EXEC;
+    ehdr->e_machine = EM_X86_64;
+    ehdr->e_shoff = shoff;
+    ehdr->e_shentsize = sizeof(Elf64_Shdr);
+    ehdr->e_shnum = 3;
+    ehdr->e_shstrndx = 1;
+    Elf64_Shdr *shdrs = (Elf64_Shdr *) (image + shoff);
+    shdrs[1] = (Elf64_Shdr) { .sh_name = 1, .sh_type = SHT_STRTAB, .sh_offset = stroff, .sh_size = sizeof(shstrtab) };
+    shdrs[2] = (Elf64_Shdr) { .sh_name = 11, .sh_type = SHT_PROGBITS, .sh_offset = lineoff, .sh_size = size };
+    memcpy(image + stroff, shstrtab, sizeof(shstrtab));
+    memcpy(image + lineoff, line, size);
+    *image_size = lineoff + size;
+    return image;
+}
+
+static void check_cfg(int (*check)(const struct cfg *, FILE *, void (*)(void *, uint64_t), void *),
+                      const uint8_t *code, size_t len, uint64_t address, const char *message)
+{
+    struct cfg cfg;
+    char *output = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&output, &size);
+
+    cfg_build(&cfg, code, len, address);
+    int errors = check(&cfg, out, NULL, NULL);
+    fclose(out);
+    if (message == NULL) {
+        assert(errors == 0);
+    } else {
+        assert(errors == 1 && strstr(output, message) != NULL);
+    }
+    free(output);
+    cfg_free(&cfg);
+}
+
 static void check_suboptimal_nops_test(void)
 {
     static const uint8_t nop[] = { 0x90, };  // nop
@@ -147,6 +241,589 @@ static void check_superfluous_lock_prefix_test(void)
     CHECK_BYTES( check_superfluous_lock_prefix, 0x87, 0x07);  // xchg [eax], ebx
 }
 
+static void check_oversized_branch_test(void)
+{
+    CHECK_BYTES(!check_oversized_branch, 0xe9, 0x7c, 0x00, 0x00, 0x00);  // jmp rel32 +0x7c
+    CHECK_BYTES( check_oversized_branch, 0xe9, 0x7d, 0x00, 0x00, 0x00);  // jmp rel32 +0x7d
+    CHECK_BYTES( check_oversized_branch, 0xeb, 0x00);  // jmp rel8 +0
+    CHECK_BYTES(!check_oversized_branch, 0x0f, 0x84, 0x7b, 0x00, 0x00, 0x00);  // je rel32 +0x7b
+    CHECK_BYTES( check_oversized_branch, 0x0f, 0x84, 0x7c, 0x00, 0x00, 0x00);  // je rel32 +0x7c
+    CHECK_BYTES(!check_oversized_branch, 0x0f, 0x84, 0x7c, 0xff, 0xff, 0xff);  // je rel32 -0x84
+    CHECK_BYTES( check_oversized_branch, 0xe8, 0x00, 0x00, 0x00, 0x00);  // call rel32 +0
+}
+
+static void check_oversized_displacement_test(void)
+{
+    CHECK_BYTES(!check_oversized_displacement, 0x8b, 0x80, 0x10, 0x00, 0x00, 0x00);  // mov eax, [rax+0x10]
+    CHECK_BYTES( check_oversized_displacement, 0x8b, 0x40, 0x10);  // mov eax, [rax+0x10]
+    CHECK_BYTES( check_oversized_displacement, 0x8b, 0x80, 0x80, 0x00, 0x00, 0x00);  // mov eax, [rax+0x80]
+    CHECK_BYTES( check_oversized_displacement, 0x8b, 0x05, 0x10, 0x00, 0x00, 0x00);  // mov eax, [rip+0x10]
+    CHECK_BYTES( check_oversized_displacement, 0x8b, 0x04, 0x25, 0x10, 0x00, 0x00, 0x00);  // mov eax, [0x10]
+    CHECK_BYTES( check_oversized_displacement, 0x0f, 0x1f, 0x80, 0x00, 0x00, 0x00, 0x00);  // nop [rax+0]
+    CHECK_BYTES(!check_oversized_displacement, 0x62, 0xf1, 0x7c, 0x48, 0x28, 0x80, 0x40, 0x00, 0x00, 0x00);  // vmovaps zmm0, [rax+0x40]
+    CHECK_BYTES( check_oversized_displacement, 0x62, 0xf1, 0x7c, 0x48, 0x28, 0x80, 0x41, 0x00, 0x00, 0x00);  // vmovaps zmm0, [rax+0x41]
+    CHECK_BYTES(!check_oversized_displacement, 0x62, 0xf1, 0x7c, 0x48, 0x28, 0x80, 0xc0, 0x1f, 0x00, 0x00);  // vmovaps zmm0, [rax+0x1fc0]
+    CHECK_BYTES( check_oversized_displacement, 0x62, 0xf1, 0x7c, 0x48, 0x28, 0x80, 0x00, 0x20, 0x00, 0x00);  // vmovaps zmm0, [rax+0x2000]
+    CHECK_BYTES(!check_oversized_displacement, 0x62, 0xf1, 0x74, 0x58, 0x58, 0x80, 0x10, 0x00, 0x00, 0x00);  // vaddps zmm0, zmm1, [rax+0x10]{1to16}
+}
+
+static void check_redundant_displacement_test(void)
+{
+    CHECK_BYTES(!check_redundant_displacement, 0x8b, 0x40, 0x00);  // mov eax, [rax+0]
+    CHECK_BYTES( check_redundant_displacement, 0x8b, 0x45, 0x00);  // mov eax, [rbp+0]
+    CHECK_BYTES( check_redundant_displacement, 0x41, 0x8b, 0x45, 0x00);  // mov eax, [r13+0]
+    CHECK_BYTES(!check_redundant_displacement, 0x8b, 0x44, 0x05, 0x00);  // mov eax, [rbp+rax*1+0]
+    CHECK_BYTES( check_redundant_displacement, 0x8b, 0x44, 0x45, 0x00);  // mov eax, [rbp+rax*2+0]
+    CHECK_BYTES( check_redundant_displacement, 0x0f, 0x1f, 0x40, 0x00);  // nop [rax+0]
+}
+
+static void check_oversized_vex_test(void)
+{
+    CHECK_BYTES(!check_oversized_vex, 0xc4, 0xe1, 0x78, 0x28, 0xc1);  // vmovaps xmm0, xmm1
+    CHECK_BYTES( check_oversized_vex, 0xc5, 0xf8, 0x28, 0xc1);  // vmovaps xmm0, xmm1
+    CHECK_BYTES(!check_oversized_vex, 0xc4, 0xc1, 0x78, 0x28, 0xc0);  // vmovaps xmm0, xmm8
+    CHECK_BYTES( check_oversized_vex, 0xc4, 0x41, 0x78, 0x28, 0xc1);  // vmovaps xmm8, xmm9
+    CHECK_BYTES(!check_oversized_vex, 0xc4, 0xc1, 0x71, 0xef, 0xc0);  // vpxor xmm0, xmm1, xmm8
+    CHECK_BYTES( check_oversized_vex, 0xc4, 0xc1, 0x71, 0xfa, 0xc0);  // vpsubd xmm0, xmm1, xmm8
+    CHECK_BYTES( check_oversized_vex, 0xc4, 0xe2, 0x71, 0x00, 0xc2);  // vpshufb xmm0, xmm1, xmm2
+    CHECK_BYTES( check_oversized_vex, 0xc4, 0xe1, 0xf9, 0x7e, 0xc0);  // vmovq rax, xmm0
+}
+
+static void check_oversized_evex_test(void)
+{
+    CHECK_BYTES(!check_oversized_evex, 0x62, 0xf1, 0x74, 0x08, 0x58, 0xc2);  // vaddps xmm0, xmm1, xmm2
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf1, 0x74, 0x09, 0x58, 0xc2);  // vaddps xmm0{k1}, xmm1, xmm2
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xe1, 0x74, 0x08, 0x58, 0xc2);  // vaddps xmm16, xmm1, xmm2
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf1, 0x74, 0x48, 0x58, 0xc2);  // vaddps zmm0, zmm1, zmm2
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf1, 0x74, 0x18, 0x58, 0x00);  // vaddps xmm0, xmm1, [rax]{1to4}
+    CHECK_BYTES(!check_oversized_evex, 0x62, 0xf1, 0x74, 0x08, 0x58, 0x40, 0x01);  // vaddps xmm0, xmm1, [rax+0x10]
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf1, 0x74, 0x08, 0x58, 0x40, 0x10);  // vaddps xmm0, xmm1, [rax+0x100]
+    CHECK_BYTES(!check_oversized_evex, 0x62, 0xf1, 0x7d, 0x08, 0x6f, 0xc1);  // vmovdqa32 xmm0, xmm1
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf3, 0x75, 0x08, 0x25, 0xc2, 0x00);  // vpternlogd xmm0, xmm1, xmm2, 0
+    CHECK_BYTES(!check_oversized_evex, 0x62, 0xf2, 0x7d, 0x08, 0x58, 0xc1);  // vpbroadcastd xmm0, xmm1
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf2, 0x7d, 0x08, 0x7c, 0xc0);  // vpbroadcastd xmm0, eax
+    CHECK_BYTES(!check_oversized_evex, 0x62, 0xf3, 0xfd, 0x28, 0x00, 0xc1, 0x01);  // vpermq ymm0, ymm1, 1
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf2, 0xf5, 0x28, 0x36, 0xc2);  // vpermq ymm0, ymm1, ymm2
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf1, 0x75, 0x08, 0x76, 0xc2);  // vpcmpeqd k0, xmm1, xmm2
+    CHECK_BYTES( check_oversized_evex, 0x62, 0xf1, 0x74, 0x08, 0xc2, 0xc2, 0x00);  // vcmpeqps k0, xmm1, xmm2
+
+    CHECK_BYTES_SAVED(evex_bytes_saved, 2, 0x62, 0xf1, 0xf5, 0x08, 0x58, 0xc2);  // vaddpd xmm0, xmm1, xmm2
+    CHECK_BYTES_SAVED(evex_bytes_saved, 2, 0x62, 0xf1, 0x7f, 0x08, 0x2a, 0xc0);  // vcvtsi2sd xmm0, xmm0, eax
+    CHECK_BYTES_SAVED(evex_bytes_saved, 1, 0x62, 0xf1, 0xff, 0x08, 0x2a, 0xc0);  // vcvtsi2sd xmm0, xmm0, rax
+    CHECK_BYTES_SAVED(evex_bytes_saved, 1, 0x62, 0xf1, 0xff, 0x08, 0x2c, 0xc0);  // vcvttsd2si rax, xmm0
+    CHECK_BYTES_SAVED(evex_bytes_saved, 1, 0x62, 0xf1, 0xfd, 0x08, 0x6e, 0xc0);  // vmovq xmm0, rax
+    CHECK_BYTES_SAVED(evex_bytes_saved, 2, 0x62, 0xf1, 0xfe, 0x08, 0x7e, 0xc1);  // vmovq xmm0, xmm1
+}
+
+static void relax_branches_test(void)
+{
+    static const uint8_t jmp[] = { 0xe9, 0x00, 0x00, 0x00, 0x00, 0xc3, };  // jmp rel32 +0 ; ret
+    assert(relax_branches(jmp, sizeof(jmp)) == 3);
+
+    // the first JMP only reaches its target after the second shrinks
+    uint8_t chain[135];
+    memset(chain, 0x90, sizeof(chain));
+    static const uint8_t jmps[] = {
+        0xe9, 0x81, 0x00, 0x00, 0x00,  // jmp rel32 +0x81
+        0xe9, 0x00, 0x00, 0x00, 0x00,  // jmp rel32 +0
+    };
+    memcpy(chain, jmps, sizeof(jmps));
+    chain[sizeof(chain) - 1] = 0xc3;  // ret
+    assert(relax_branches(chain, sizeof(chain)) == 6);
+
+    // targets outside the region do not move
+    assert(relax_branches(chain, sizeof(chain) - 1) == 3);
+}
+
+static void cfg_build_test(void)
+{
+    static const uint8_t code[] = {
+        0x74, 0x01,  // je 3
+        0x90,  // nop
+        0xc3,  // ret
+    };
+    struct cfg cfg;
+    cfg_build(&cfg, code, sizeof(code), 0x1000);
+    assert(cfg.ninsts == 3 && cfg.nblocks == 3);
+    assert(cfg.insts[0].flow == CFG_FLOW_BRANCH && cfg.insts[0].target == 0x1003);
+    assert(cfg.blocks[0].next == 1 && cfg.blocks[0].taken == 2);
+    assert(cfg.blocks[1].next == 2 && cfg.blocks[1].taken == CFG_NO_BLOCK);
+    assert(cfg.blocks[2].next == CFG_NO_BLOCK && cfg.blocks[2].taken == CFG_NO_BLOCK);
+    assert(cfg_block_at(&cfg, 0x1003) == 2 && cfg_block_at(&cfg, 0x1001) == CFG_NO_BLOCK);
+    cfg_free(&cfg);
+}
+
+static void check_layout_test(void)
+{
+    CHECK_CFG(check_layout, 0x1000, "jump to next instruction",
+              0xeb, 0x00,  // jmp 2
+              0xc3);  // ret
+    // a tail call to the next function
+    CHECK_CFG(check_layout, 0x1000, NULL,
+              0xeb, 0x00);  // jmp 2
+    CHECK_CFG(check_layout, 0x1000, "jump to jump",
+              0xeb, 0x01,  // jmp 3
+              0xc3,  // ret
+              0xeb, 0x01,  // jmp 6
+              0xc3,  // ret
+              0x90,  // nop
+              0xc3);  // ret
+    // a deliberate spin
+    CHECK_CFG(check_layout, 0x1000, NULL,
+              0xeb, 0xfe);  // jmp 0
+    CHECK_CFG(check_layout, 0x1000, "jump to RET",
+              0xeb, 0x01,  // jmp 3
+              0x90,  // nop
+              0xc3);  // ret
+    CHECK_CFG(check_layout, 0x1000, "conditional branch over jump",
+              0x74, 0x02,  // je 4
+              0xeb, 0x01,  // jmp 5
+              0x90,  // nop
+              0x90,  // nop
+              0xc3);  // ret
+    // an 8-byte loop 4 bytes before a cache line boundary
+    CHECK_CFG(check_layout, 0x103c, "misaligned loop",
+              0x90, 0x90, 0x90, 0x90, 0x90, 0x90,  // nop
+              0xeb, 0xf8,  // jmp 0
+              0xc3);  // ret
+    CHECK_CFG(check_layout, 0x1000, NULL,
+              0x90, 0x90, 0x90, 0x90, 0x90, 0x90,  // nop
+              0xeb, 0xf8,  // jmp 0
+              0xc3);  // ret
+}
+
+static void check_forwarding_test(void)
+{
+    CHECK_CFG(check_forwarding, 0, "redundant reload",
+              0x48, 0x89, 0x44, 0x24, 0x08,  // mov [rsp+8], rax
+              0x48, 0x8b, 0x44, 0x24, 0x08,  // mov rax, [rsp+8]
+              0xc3);  // ret
+    CHECK_CFG(check_forwarding, 0, "store forwarding stall",
+              0x89, 0x44, 0x24, 0x08,  // mov [rsp+8], eax
+              0x48, 0x8b, 0x44, 0x24, 0x08,  // mov rax, [rsp+8]
+              0xc3);  // ret
+    // RDI may point at the stack slot
+    CHECK_CFG(check_forwarding, 0, NULL,
+              0x48, 0x89, 0x44, 0x24, 0x08,  // mov [rsp+8], rax
+              0x48, 0x89, 0x0f,  // mov [rdi], rcx
+              0x48, 0x8b, 0x44, 0x24, 0x08,  // mov rax, [rsp+8]
+              0xc3);  // ret
+    CHECK_CFG(check_forwarding, 0, NULL,
+              0x48, 0x89, 0x44, 0x24, 0x08,  // mov [rsp+8], rax
+              0xb8, 0x01, 0x00, 0x00, 0x00,  // mov eax, 1
+              0x48, 0x8b, 0x44, 0x24, 0x08,  // mov rax, [rsp+8]
+              0xc3);  // ret
+    // PUSH and POP move RSP so [rsp+8] names another slot
+    CHECK_CFG(check_forwarding, 0, NULL,
+              0x48, 0x89, 0x44, 0x24, 0x08,  // mov [rsp+8], rax
+              0x53,  // push rbx
+              0x48, 0x8b, 0x44, 0x24, 0x08,  // mov rax, [rsp+8]
+              0xc3);  // ret
+    CHECK_CFG(check_forwarding, 0, NULL,
+              0x89, 0x44, 0x24, 0x08,  // mov [rsp+8], eax
+              0x5b,  // pop rbx
+              0x48, 0x8b, 0x44, 0x24, 0x08,  // mov rax, [rsp+8]
+              0xc3);  // ret
+}
+
+static void check_instructions_relocations_test(void)
+{
+    static const uint8_t inst[] = { 0x83, 0xff, 0x00, };  // cmp edi, 0
+    static const uint64_t relocations[] = { 2, };
+    struct x86lint_options options = { .relocations = relocations, .nrelocations = 1, };
+    assert(check_instructions_with(inst, sizeof(inst), &options) == 0);
+    options.nrelocations = 0;
+    assert(check_instructions_with(inst, sizeof(inst), &options) == 1);
+}
+
+static void x86_length_decode_test(void)
+{
+    CHECK_LENGTH(0x90);  // nop
+    CHECK_LENGTH(0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00);  // nop word ptr [rax+rax*1+0x0]
+    CHECK_LENGTH(0x48, 0xb8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);  // mov rax, 0
+    CHECK_LENGTH(0x66, 0xb8, 0x01, 0x00);  // mov ax, 1
+    CHECK_LENGTH(0x66, 0x05, 0x01, 0x00);  // add ax, 1
+    CHECK_LENGTH(0x67, 0x8b, 0x04, 0x24);  // mov eax, [esp]
+    CHECK_LENGTH(0x8b, 0x05, 0x00, 0x00, 0x00, 0x00);  // mov eax, [rip+0]
+    CHECK_LENGTH(0x8b, 0x44, 0x25, 0x00);  // mov eax, [rbp+riz*1+0]
+    CHECK_LENGTH(0xf6, 0x00, 0x01);  // test byte ptr [rax], 1
+    CHECK_LENGTH(0xf7, 0x18);  // neg dword ptr [rax]
+    CHECK_LENGTH(0xa1, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);  // movabs eax, [0]
+    CHECK_LENGTH(0xc8, 0x10, 0x00, 0x00);  // enter 0x10, 0
+    CHECK_LENGTH(0xe8, 0x00, 0x00, 0x00, 0x00);  // call rel32
+    CHECK_LENGTH(0x0f, 0x84, 0x00, 0x00, 0x00, 0x00);  // je rel32
+    CHECK_LENGTH(0xc7, 0xf8, 0x00, 0x00, 0x00, 0x00);  // xbegin rel32
+    CHECK_LENGTH(0x66, 0x0f, 0x3a, 0x0f, 0xc1, 0x08);  // palignr xmm0, xmm1, 8
+    CHECK_LENGTH(0xf3, 0x0f, 0xb8, 0xc1);  // popcnt eax, ecx
+    CHECK_LENGTH(0xc5, 0xf8, 0x77);  // vzeroupper
+    CHECK_LENGTH(0xc4, 0xe3, 0x7d, 0x18, 0xc1, 0x01);  // vinsertf128 ymm0, ymm0, xmm1, 1
+    CHECK_LENGTH(0x62, 0xf1, 0x7c, 0x48, 0x28, 0x44, 0x24, 0x01);  // vmovaps zmm0, [rsp+0x40]
+}
+
+static void is_nop_test(void)
+{
+    CHECK_NOP(true, 0x90);  // nop
+    CHECK_NOP(true, 0x66, 0x90);  // xchg ax, ax
+    CHECK_NOP(false, 0x41, 0x90);  // xchg r8d, eax
+    CHECK_NOP(false, 0xf3, 0x90);  // pause
+    CHECK_NOP(true, 0x0f, 0x1f, 0x00);  // nop dword ptr [rax]
+    CHECK_NOP(true, 0x0f, 0x1f, 0x44, 0x00, 0x00);  // nop dword ptr [rax+rax*1+0]
+    CHECK_NOP(true, 0x66, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00);  // nop word ptr [rax+rax*1+0]
+    CHECK_NOP(true, 0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00);  // 10-byte nop
+    CHECK_NOP(true, 0x66, 0x66, 0x2e, 0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00);  // 11-byte nop
+    CHECK_NOP(true, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x2e,
+              0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00);  // 15-byte nop
+    // 0F 1F /1 is a reserved hint rather than the NOP
+    CHECK_NOP(false, 0x0f, 0x1f, 0x48, 0x00);
+    CHECK_NOP(false, 0xcc);  // int3
+}
+
+static void padding_find_runs_test(void)
+{
+    static const uint8_t code[] = {
+        // f1
+        0xc3,  // ret
+        0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x2e,
+        0x0f, 0x1f, 0x84, 0x00, 0x00, 0x00, 0x00, 0x00,  // 15-byte nop
+        // f2 at 0x1010
+        0x31, 0xc0,  // xor eax, eax
+        0x66, 0x0f, 0x1f, 0x44, 0x00, 0x00,  // nop word ptr [rax+rax*1+0]
+        0xff, 0xc0,  // inc eax
+        0x90,  // nop
+        0x83, 0xf8, 0x0a,  // cmp eax, 10
+        0x75, 0xf8,  // jne 0x1018
+        0xc3,  // ret
+        0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc,
+        0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc, 0xcc,  // int3
+        // f3 at 0x1030
+        0xc3,  // ret
+        0xcc,  // int3
+        0x41, 0x90,  // xchg r8d, eax
+        0xf3, 0x90,  // pause
+        0xc3,  // ret
+    };
+    static const struct elf_symbol syms[] = {
+        { "f1", 0x1000, 0x1, NULL },
+        { "f2", 0x1010, 0x11, NULL },
+        { "f3", 0x1030, 0x7, NULL },
+    };
+    struct padding_run *runs;
+    size_t nruns = padding_find_runs(code, sizeof(code), 0x1000, syms, 3, &runs);
+
+    // the INT3 after f3's first RET is a trap
+    assert(nruns == 4);
+    assert(runs[0].start == 0x1001 && runs[0].end == 0x1010 && runs[0].kind == PADDING_FUNCTION);
+    assert(!runs[0].fall_through && !runs[0].has_int3);
+    assert(runs[1].start == 0x1012 && runs[1].end == 0x1018 && runs[1].kind == PADDING_LOOP);
+    assert(runs[1].fall_through && !runs[1].hot);
+    assert(runs[2].start == 0x101a && runs[2].end == 0x101b && runs[2].kind == PADDING_OTHER);
+    assert(runs[2].fall_through && runs[2].hot);
+    assert(runs[3].start == 0x1021 && runs[3].end == 0x1030 && runs[3].kind == PADDING_FUNCTION);
+    assert(runs[3].has_int3 && !runs[3].fall_through);
+    free(runs);
+
+    struct padding_stats stats = { 0 };
+    struct padding_run run = { 0x1001, 0x1010, PADDING_FUNCTION, false, false, false };
+    padding_add_stats(&stats, &run);
+    assert(stats.bytes == 15 && stats.runs == 1 && stats.lines == 1 && stats.full_lines == 0);
+    // touches 0x1000-0x10ff and fills 0x1040-0x10bf
+    run = (struct padding_run) { 0x1030, 0x10d0, PADDING_OTHER, false, false, false };
+    padding_add_stats(&stats, &run);
+    assert(stats.bytes == 15 + 160 && stats.runs == 2 && stats.lines == 1 + 4 && stats.full_lines == 2);
+}
+
+// expect address to map to path:line, or to no row if path is NULL
+static void check_line(const struct line_index *index, uint64_t address, const char *path, uint32_t line)
+{
+    const struct line_row *row = line_index_lookup(index, address);
+    if (path == NULL) {
+        assert(row == NULL);
+    } else {
+        assert(row != NULL && strcmp(index->files[row->file], path) == 0 && row->line == line);
+    }
+}
+
+static void line_index_test(void)
+{
+    static const uint8_t line[] = {
+        // DWARF 4 unit
+        0x5b, 0x00, 0x00, 0x00,  // unit_length
+        0x04, 0x00,  // version
+        0x2b, 0x00, 0x00, 0x00,  // header_length
+        0x01, 0x01, 0x01,  // minimum_instruction_length, maximum_operations_per_instruction, default_is_stmt
+        0xfb, 0x0e, 0x0d,  // line_base -5, line_range 14, opcode_base 13
+        0x00, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x01,  // standard_opcode_lengths
+        's', 'r', 'c', 0x00, 0x00,  // include_directories
+        'a', '.', 'c', 0x00, 0x01, 0x00, 0x00,  // file 1 in directory 1
+        '/', 'a', 'b', 's', '/', 'b', '.', 'h', 0x00, 0x00, 0x00, 0x00,  // file 2
+        0x00,
+        0x00, 0x09, 0x02, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // DW_LNE_set_address 0x1000
+        0x01,  // DW_LNS_copy
+        0x03, 0x04,  // DW_LNS_advance_line 4
+        0x02, 0x10,  // DW_LNS_advance_pc 0x10
+        0x01,  // DW_LNS_copy
+        0x04, 0x02,  // DW_LNS_set_file 2
+        0x2f,  // special opcode: address 2, line 1
+        0x02, 0x0e,  // DW_LNS_advance_pc 0xe
+        0x00, 0x01, 0x01,  // DW_LNE_end_sequence at 0x1020
+        // a function the linker discarded
+        0x00, 0x09, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // DW_LNE_set_address 0
+        0x01,  // DW_LNS_copy
+        0x02, 0x04,  // DW_LNS_advance_pc 4
+        0x00, 0x01, 0x01,  // DW_LNE_end_sequence
+
+        // DWARF 5 unit
+        0x44, 0x00, 0x00, 0x00,  // unit_length
+        0x05, 0x00,  // version
+        0x08, 0x00,  // address_size, segment_selector_size
+        0x2b, 0x00, 0x00, 0x00,  // header_length
+        0x01, 0x01, 0x01,
+        0xfb, 0x0e, 0x0d,
+        0x00, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x01,
+        0x01, 0x01, 0x08,  // directory format: DW_LNCT_path DW_FORM_string
+        0x01, '/', 's', 'r', 'c', 0x00,  // 1 directory
+        0x02, 0x01, 0x08, 0x02, 0x0f,  // file format: path string, DW_LNCT_directory_index DW_FORM_udata
+        0x02, 'c', '.', 'c', 0x00, 0x00, 'd', '.', 'c', 0x00, 0x00,  // 2 files
+        0x00, 0x09, 0x02, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // DW_LNE_set_address 0x2000
+        0x01,  // DW_LNS_copy in file 1
+        0x02, 0x04,  // DW_LNS_advance_pc 4
+        0x00, 0x01, 0x01,  // DW_LNE_end_sequence
+
+        // DWARF 5 unit naming its file by string index
+        0x3e, 0x00, 0x00, 0x00,  // unit_length
+        0x05, 0x00,
+        0x08, 0x00,
+        0x23, 0x00, 0x00, 0x00,  // header_length
+        0x01, 0x01, 0x01,
+        0xfb, 0x0e, 0x0d,
+        0x00, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x01,
+        0x01, 0x01, 0x08,
+        0x01, '/', 's', 'r', 'c', 0x00,
+        0x02, 0x01, 0x25, 0x02, 0x0f,  // file format: path DW_FORM_strx1, directory index
+        0x01, 0x00, 0x00,  // 1 file
+        0x00, 0x09, 0x02, 0x00, 0x30, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // DW_LNE_set_address 0x3000
+        0x04, 0x00,  // DW_LNS_set_file 0
+        0x01,  // DW_LNS_copy
+        0x02, 0x02,  // DW_LNS_advance_pc 2
+        0x00, 0x01, 0x01,  // DW_LNE_end_sequence
+    };
+    size_t size;
+    uint8_t *image = debug_line_image(line, sizeof(line), &size);
+    struct elf_file elf;
+    struct line_index index;
+    assert(elf_init(&elf, image, size) == 0);
+    assert(line_index_build(&index, &elf) == 0);
+
+    check_line(&index, 0x0fff, NULL, 0);
+    check_line(&index, 0x1000, "src/a.c", 1);
+    check_line(&index, 0x100f, "src/a.c", 1);
+    check_line(&index, 0x1010, "src/a.c", 5);
+    check_line(&index, 0x1012, "/abs/b.h", 6);
+    check_line(&index, 0x101f, "/abs/b.h", 6);
+    check_line(&index, 0x1020, NULL, 0);
+    check_line(&index, 0, NULL, 0);
+    check_line(&index, 0x2003, "/src/d.c", 1);
+    check_line(&index, 0x2004, NULL, 0);
+    check_line(&index, 0x3000, "??", 1);
+
+    line_index_free(&index);
+    free(image);
+
+    // header_length past the end of the unit
+    uint8_t truncated[sizeof(line)];
+    memcpy(truncated, line, sizeof(line));
+    truncated[6] = 0xff;
+    image = debug_line_image(truncated, sizeof(truncated), &size);
+    assert(elf_init(&elf, image, size) == 0);
+    assert(line_index_build(&index, &elf) == -1);
+    free(image);
+}
+
+static void hash_code_test(void)
+{
+    static const uint8_t at_1000[] = {
+        0x48, 0x8b, 0x05, 0xf9, 0x0f, 0x00, 0x00,  // mov rax, [rip+0xff9] (0x2000)
+        0x85, 0xc0,  // test eax, eax
+        0x74, 0x05,  // je 0x1010
+        0xe8, 0xf0, 0x3f, 0x00, 0x00,  // call 0x5000
+        0xc3,  // ret
+    };
+    // the same function at 0x3000 reading and calling the same addresses
+    static const uint8_t at_3000[] = {
+        0x48, 0x8b, 0x05, 0xf9, 0xef, 0xff, 0xff,  // mov rax, [rip-0x1007] (0x2000)
+        0x85, 0xc0,  // test eax, eax
+        0x74, 0x05,  // je 0x3010
+        0xe8, 0xf0, 0x1f, 0x00, 0x00,  // call 0x5000
+        0xc3,  // ret
+    };
+    static const uint8_t lea[] = {
+        0x48, 0x8d, 0x05, 0xf9, 0x0f, 0x00, 0x00,  // lea rax, [rip+0xff9]
+        0x85, 0xc0,  // test eax, eax
+        0x74, 0x05,  // je 0x1010
+        0xe8, 0xf0, 0x3f, 0x00, 0x00,  // call 0x5000
+        0xc3,  // ret
+    };
+    uint64_t hash = hash_code(at_1000, sizeof(at_1000), 0x1000, false);
+
+    assert(hash_bytes(at_1000, sizeof(at_1000)) != hash_bytes(at_3000, sizeof(at_3000)));
+    assert(hash_code(at_3000, sizeof(at_3000), 0x3000, false) == hash);
+    assert(hash_code(lea, sizeof(lea), 0x1000, false) != hash);
+}
+
+static void hash_code_targets_test(void)
+{
+    static const uint8_t at_1000[] = {
+        0xe8, 0xfb, 0x3f, 0x00, 0x00,  // call 0x5000
+        0xc3,  // ret
+    };
+    static const uint8_t at_2000[] = {
+        0xe8, 0xfb, 0x2f, 0x00, 0x00,  // call 0x5000
+        0xc3,  // ret
+    };
+    uint64_t hash = hash_code(at_1000, sizeof(at_1000), 0x1000, true);
+
+    assert(hash_code(at_2000, sizeof(at_2000), 0x2000, true) == hash);
+    // the same bytes at 0x2000 call 0x6000
+    assert(hash_code(at_1000, sizeof(at_1000), 0x2000, true) != hash);
+    assert(hash_code(at_1000, sizeof(at_1000), 0x2000, false) == hash_code(at_1000, sizeof(at_1000), 0x1000, false));
+
+    static const uint8_t je_ret[] = {
+        0x74, 0x01,  // je 3
+        0x90,  // nop
+        0xc3,  // ret
+    };
+    static const uint8_t je_nop[] = {
+        0x74, 0x00,  // je 2
+        0x90,  // nop
+        0xc3,  // ret
+    };
+    // branches within the function keep their displacement
+    assert(hash_code(je_ret, sizeof(je_ret), 0x1000, true) != hash_code(je_nop, sizeof(je_nop), 0x1000, true));
+    assert(hash_code(je_ret, sizeof(je_ret), 0x1000, true) == hash_code(je_ret, sizeof(je_ret), 0x2000, true));
+}
+
+static void throughput_estimate_test(void)
+{
+    const struct uarch *skl = uarch_find("skl");
+    struct throughput_estimate est;
+
+    static const uint8_t add_chain[] = {
+        0x48, 0x01, 0xd8,  // add rax, rbx
+        0x48, 0x01, 0xd8,  // add rax, rbx
+        0x48, 0x01, 0xd8,  // add rax, rbx
+        0x48, 0x01, 0xd8,  // add rax, rbx
+        0xff, 0xc9,  // dec ecx
+        0x75, 0xf0,  // jne 0
+    };
+    throughput_estimate_code(skl, add_chain, sizeof(add_chain), 0x1000, &est);
+    assert(est.bottleneck == THROUGHPUT_DEPENDENCY);
+    assert(est.cycles == 4);
+
+    // the loads issue to their own ports, leaving the four-wide front-end as
+    // the limit; DEC and JNE fuse into one uop
+    static const uint8_t independent[] = {
+        0x01, 0xf0,  // add eax, esi
+        0x01, 0xf3,  // add ebx, esi
+        0x01, 0xf2,  // add edx, esi
+        0x01, 0xf7,  // add edi, esi
+        0x4c, 0x8b, 0x44, 0x24, 0x08,  // mov r8, [rsp+8]
+        0x4c, 0x8b, 0x4c, 0x24, 0x10,  // mov r9, [rsp+16]
+        0xff, 0xc9,  // dec ecx
+        0x75, 0xea,  // jne 0
+    };
+    throughput_estimate_code(skl, independent, sizeof(independent), 0x1000, &est);
+    assert(est.bottleneck == THROUGHPUT_FRONT_END);
+    assert(est.cycles == 7.0 / 4);
+
+    static const uint8_t div_zero_idiom[] = {
+        0x31, 0xd2,  // xor edx, edx
+        0x89, 0xf0,  // mov eax, esi
+        0xf7, 0xf7,  // div edi
+        0xff, 0xc9,  // dec ecx
+        0x75, 0xf6,  // jne 0
+    };
+    throughput_estimate_code(skl, div_zero_idiom, sizeof(div_zero_idiom), 0x1000, &est);
+    assert(est.bottleneck == THROUGHPUT_PORTS);
+    assert(est.ports == 0);
+    assert(est.cycles == skl->costs[UOP_DIV32].divider);
+
+    // without the zero idiom each DIV waits for the previous remainder
+    static const uint8_t div_chain[] = {
+        0x31, 0xfa,  // xor edx, edi
+        0x89, 0xf0,  // mov eax, esi
+        0xf7, 0xf7,  // div edi
+        0xff, 0xc9,  // dec ecx
+        0x75, 0xf6,  // jne 0
+    };
+    throughput_estimate_code(skl, div_chain, sizeof(div_chain), 0x1000, &est);
+    assert(est.bottleneck == THROUGHPUT_DEPENDENCY);
+    assert(est.cycles == skl->costs[UOP_DIV32].latency + skl->costs[UOP_ALU].latency);
+}
+
+static void plt_find_calls_test(void)
+{
+    struct plt_callee callees[] = {
+        { "memcpy", false, 0, 0, 0, 0, 0 },
+        { "helper", true, 0, 0, 0, 0, 0 },
+    };
+    struct plt_slot slots[] = { { 0x3000, 1 }, { 0x3008, 0 } };
+    struct plt_stub stubs[] = { { 0x2010, 1 }, { 0x2020, 0 } };
+    struct plt_calls calls = { callees, 2, slots, 2, stubs, 2, NULL, 0 };
+    static const uint8_t code[] = {
+        0xe8, 0x0b, 0x10, 0x00, 0x00,  // call 0x2010
+        0xff, 0x15, 0xfd, 0x1f, 0x00, 0x00,  // call [rip+0x1ffd], slot 0x3008
+        0xff, 0xc9,  // dec ecx
+        0x75, 0xf6,  // jne 0x1005
+        0xe8, 0xec, 0x0f, 0x00, 0x00,  // call 0x2000, not a stub
+        0xe9, 0x07, 0x10, 0x00, 0x00,  // jmp 0x2020
+    };
+    struct cfg cfg;
+    struct plt_site *sites;
+
+    cfg_build(&cfg, code, sizeof(code), 0x1000);
+    assert(plt_find_calls(&calls, &cfg, &sites) == 3);
+    assert(sites[0].callee == 1 && sites[0].via_plt && !sites[0].in_loop);
+    assert(sites[1].callee == 0 && !sites[1].via_plt && sites[1].in_loop);
+    assert(sites[2].callee == 0 && sites[2].via_plt && !sites[2].in_loop);
+    free(sites);
+    cfg_free(&cfg);
+}
+
+static void check_instructions_resync_test(void)
+{
+    static const uint8_t inst[] = {
+        0x06,  // push es, invalid in 64-bit mode
+        0x83, 0xff, 0x00,  // cmp edi, 0
+    };
+    struct x86lint_options options = { 0 };
+    assert(check_instructions_with(inst, sizeof(inst), &options) == -1);
+    options.resync = true;
+    assert(check_instructions_with(inst, sizeof(inst), &options) == 1);
+}
+
+static void check_instructions_window_test(void)
+{
+    static const uint8_t inst[] = {
+        0xb8, 0x83, 0xff, 0x00, 0x00,  // mov eax, 0xff83
+        0x83, 0xff, 0x00,  // cmp edi, 0
+        0x83, 0xff,  // cmp edi, 0 continued in the next window
+    };
+    size_t consumed = 0;
+    struct x86lint_options options = { 0 };
+    options.consumed = &consumed;
+    assert(check_instructions_with(inst, sizeof(inst), &options) == 1);
+    assert(consumed == 8);
+    assert(check_instructions_with(inst, 8, &options) == 1);
+    assert(consumed == 8);
+
+    // decoding from offset 1 would find cmp edi, 0 inside the immediate
+    options.consumed = NULL;
+    options.lead = 1;
+    assert(check_instructions_with(inst, 8, &options) == 1);
+    options.lead = 8;
+    assert(check_instructions_with(inst, 8, &options) == 0);
+}
+
 int main(int argc, char *argv[])
 {
     xed_tables_init();
@@ -163,6 +840,26 @@ int main(int argc, char *argv[])
     check_and_strength_reduce_test();
     check_missing_lock_prefix_test();
     check_superfluous_lock_prefix_test();
+    check_oversized_branch_test();
+    check_oversized_displacement_test();
+    check_redundant_displacement_test();
+    check_oversized_vex_test();
+    check_oversized_evex_test();
+    relax_branches_test();
+    cfg_build_test();
+    check_layout_test();
+    check_forwarding_test();
+    check_instructions_relocations_test();
+    check_instructions_resync_test();
+    check_instructions_window_test();
+    x86_length_decode_test();
+    is_nop_test();
+    padding_find_runs_test();
+    line_index_test();
+    hash_code_test();
+    hash_code_targets_test();
+    throughput_estimate_test();
+    plt_find_calls_test();
 
     static const uint8_t inst[] = {
         0x90, 0x90,  // nop ; nop
@@ -188,5 +885,13 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    // the length decoder agrees with XED and its prefilter skips no findings
+    struct x86lint_options options = { .validate_length = true, };
+    actual = check_instructions_with(inst, sizeof(inst), &options);
+    if (actual != expected) {
+        printf("Expected %d errors with decoder validation, actual: %d\n", expected, actual);
+        return 1;
+    }
+
     return 0;
 }